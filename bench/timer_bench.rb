@@ -0,0 +1,133 @@
+##
+## Timer benchmarks, run with `rake bench` or
+##   ./mruby/bin/mruby bench/timer_bench.rb [count] [samples]
+##
+## For each notification mode: creation rate, start/stop rate, fire to
+## handler latency and CPU used while timers are armed.
+##
+
+COUNT = (ARGV[0] || 10_000).to_i
+SAMPLES = (ARGV[1] || 200).to_i
+PERIOD_MSEC = 5
+FLEET = 100
+CPU_WINDOW_USEC = 500_000
+
+def now_ns
+  Timer.clock_gettime_ns(Timer::CLOCK_MONOTONIC)
+end
+
+def cpu_ns
+  Timer.clock_gettime_ns(Timer::CLOCK_PROCESS_CPUTIME_ID)
+end
+
+# ops per second of n runs of the block
+def rate(n)
+  t = now_ns
+  n.times { |i| yield i }
+  n * 1_000_000_000.0 / (now_ns - t)
+end
+
+# process CPU over wall time, in percent
+def cpu_usage
+  c = cpu_ns
+  t = now_ns
+  usleep CPU_WINDOW_USEC
+  (cpu_ns - c) * 100.0 / (now_ns - t)
+end
+
+def fmt_ns(v)
+  v ? "%.1fus" % (v / 1000.0) : "n/a"
+end
+
+def report(mode, key, value)
+  puts "%-12s %-22s %s" % [mode, key, value]
+end
+
+def wait_for(timeout_msec)
+  deadline = now_ns + timeout_msec * 1_000_000
+  until yield || now_ns > deadline
+    usleep 1000
+  end
+end
+
+# The handler records on a SIGEV_NONE shadow timer armed with the same schedule,
+# so the lateness is measured when the handler runs and never on the notifier side
+shadow = Timer::POSIX.new(signal: nil, clock_id: Timer::CLOCK_MONOTONIC)
+sth = SignalThread.trap(:RT3) { shadow.mark_fired }
+SignalThread.trap(:RT4) { shadow.mark_fired }
+
+modes = {
+  "none" => lambda { Timer::POSIX.new(signal: nil, clock_id: Timer::CLOCK_MONOTONIC) },
+  "signal" => lambda { Timer::POSIX.new(signal: :RT4, clock_id: Timer::CLOCK_MONOTONIC) },
+  "thread" => lambda {
+    Timer::POSIX.new(signal: :RT3, thread_id: sth.thread_id, dispatcher: false, clock_id: Timer::CLOCK_MONOTONIC)
+  },
+  "wheel" => lambda { Timer::Wheel.new(signal: :RT3, thread_id: sth.thread_id) },
+}
+if Timer::POSIX.respond_to?(:dispatcher?)
+  modes["dispatcher"] = lambda {
+    Timer::POSIX.new(signal: :RT3, thread_id: sth.thread_id, dispatcher: true, clock_id: Timer::CLOCK_MONOTONIC)
+  }
+end
+
+modes.each do |mode, make|
+  report mode, "create+close/sec", "%.0f" % rate(COUNT) { t = make.call; t.respond_to?(:close) ? t.close : t.stop }
+
+  t = make.call
+  report mode, "start+stop/sec", "%.0f" % rate(COUNT) { t.start 1000, 1000; t.stop }
+
+  if mode == "none"
+    report mode, "fire to handler", "n/a (no notification)"
+  else
+    first = shadow.now_ns + PERIOD_MSEC * 1_000_000
+    shadow.reset_stats
+    shadow.start_at first, PERIOD_MSEC * 1_000_000
+    if t.respond_to?(:start_at)
+      t.start_at first, PERIOD_MSEC * 1_000_000
+    else
+      # the wheel only has relative starts, it is at most a tick behind the shadow
+      t.start PERIOD_MSEC, PERIOD_MSEC
+    end
+    wait_for(SAMPLES * PERIOD_MSEC * 4) { st = shadow.stats; st[:fired] + st[:overruns] >= SAMPLES }
+    t.stop
+    shadow.stop
+    st = shadow.stats
+    report mode, "fire to handler p50", fmt_ns(st[:p50_ns])
+    report mode, "fire to handler p99", fmt_ns(st[:p99_ns])
+    report mode, "fire to handler max", fmt_ns(st[:max_ns])
+    report mode, "handled/expired", "#{st[:fired]}/#{st[:fired] + st[:overruns]}"
+  end
+  t.close if t.respond_to?(:close)
+
+  fleet = (1..FLEET).map { make.call }
+  fleet.each { |f| f.start 60_000 }
+  report mode, "idle CPU (#{FLEET} armed)", "%.2f%%" % cpu_usage
+  fleet.each { |f| f.start 10, 10 }
+  report mode, "CPU (#{FLEET} x 10ms)", "%.2f%%" % cpu_usage
+  fleet.each { |f| f.respond_to?(:close) ? f.close : f.stop }
+end
+
+# TimerThread runs one pthread per run, so it gets fewer iterations
+mode = "timerthread"
+n = COUNT / 10
+report mode, "create/sec", "%.0f" % rate(n) { TimerThread.new }
+
+th = TimerThread.new
+report mode, "run(0)+wait/sec", "%.0f" % rate(n) { th.run 0; th.wait }
+
+shadow.reset_stats
+SAMPLES.times do |i|
+  # the worker computes its deadline just after the shadow, lateness is overestimated by that gap
+  shadow.start_at shadow.now_ns + PERIOD_MSEC * 1_000_000
+  th.run_with_signal PERIOD_MSEC, :RT3, sth.thread_id
+  wait_for(PERIOD_MSEC * 100) { shadow.stats[:fired] > i }
+end
+st = shadow.stats
+report mode, "fire to handler p50", fmt_ns(st[:p50_ns])
+report mode, "fire to handler p99", fmt_ns(st[:p99_ns])
+report mode, "fire to handler max", fmt_ns(st[:max_ns])
+report mode, "handled/expired", "#{st[:fired]}/#{SAMPLES}"
+
+fleet = (1..FLEET).map { TimerThread.new }
+fleet.each { |f| f.run 60_000 }
+report mode, "idle CPU (#{FLEET} armed)", "%.2f%%" % cpu_usage
@@ -4,4 +4,6 @@ MRuby::Build.new do |conf|
   conf.gem File.expand_path(File.dirname(__FILE__))
   conf.enable_test
   conf.cc.flags << "-DMRB_THREAD_COPY_VALUES"
+  # lets Timer.timeout interrupt a running block (Timer::TIMEOUT_INTERRUPTS)
+  conf.cc.flags << "-DMRB_ENABLE_DEBUG_HOOK"
 end
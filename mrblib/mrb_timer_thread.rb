@@ -1,46 +1,56 @@
 class TimerThread
-  def initialize retry_timer_usec = 1000
-    # TODO
-    @timer_thread = nil
-    @timer_interval_usec = 1000
-  end
+  if method_defined?(:wait)
+    # run, run_with_signal, running? and wait are implemented in C
+    def blocking_handler
+      wait
+      yield
+    end
+  else
+    # Fallback polling an mruby Thread, where POSIX timer is unavailable (MacOS)
+    # precision: is accepted and ignored, the poll interval bounds the accuracy
+    def initialize retry_timer_usec = 1000, options = nil
+      retry_timer_usec = 1000 if retry_timer_usec.is_a?(Hash)
+      @timer_thread = nil
+      @timer_interval_usec = retry_timer_usec
+    end
 
-  def timer_proc(timer)
-    Proc.new do
-      loop_time = 0
-      # calculate by usec
-      while loop_time < timer * 1000
-        loop_time += usleep @timer_interval_usec
+    def timer_proc(timer)
+      Proc.new do
+        loop_time = 0
+        # calculate by usec
+        while loop_time < timer * 1000
+          loop_time += usleep @timer_interval_usec
+        end
       end
     end
-  end
 
-  def run msec_timer
-    @timer_thread = Thread.new timer_proc(msec_timer) do |timer|
-      timer.call
+    def run msec_timer
+      @timer_thread = Thread.new timer_proc(msec_timer) do |timer|
+        timer.call
+      end
     end
-  end
 
-  def run_with_signal msec_timer, signal, thread_id
-    sigstr = signal.to_s
-    sig = Proc.new do
-      timer_proc(msec_timer).call
-      SignalThread.kill_by_thread_id thread_id, sigstr
-    end
+    def run_with_signal msec_timer, signal, thread_id
+      sigstr = signal.to_s
+      sig = Proc.new do
+        timer_proc(msec_timer).call
+        SignalThread.kill_by_thread_id thread_id, sigstr
+      end
 
-    # thread attach another mrb_state, so need msec_timer arg
-    @timer_thread = Thread.new sig do |signal_timer|
-      signal_timer.call
+      # thread attach another mrb_state, so need msec_timer arg
+      @timer_thread = Thread.new sig do |signal_timer|
+        signal_timer.call
+      end
     end
-  end
 
-  def running?
-    @timer_thread.alive?
-  end
+    def running?
+      @timer_thread.alive?
+    end
 
-  def blocking_handler
-    @timer_thread.join
-    yield
+    def blocking_handler
+      @timer_thread.join
+      yield
+    end
   end
 end
 
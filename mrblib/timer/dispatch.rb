@@ -0,0 +1,40 @@
+module Timer
+  # id => [timer, handler] of the timers served by Timer.dispatch
+  def self.registry
+    @registry ||= {}
+  end
+
+  # Runs handler with (timer, siginfo) when a signal carrying timer.id is dispatched
+  def self.register(timer, &handler)
+    raise ArgumentError, "no handler given" unless handler
+    registry[timer.id] = [timer, handler]
+    timer
+  end
+
+  def self.unregister(timer)
+    !registry.delete(timer.id).nil?
+  end
+
+  # siginfo is a Hash from Timer.sigwaitinfo or a bare sigev_value id,
+  # true when a registered handler ran
+  def self.dispatch(siginfo)
+    id = siginfo.is_a?(Hash) ? siginfo[:value] : siginfo
+    entry = registry[id]
+    return false unless entry
+    entry[1].call(entry[0], siginfo)
+    true
+  end
+
+  # Waits up to timeout_msec (forever with nil) for signal, then dispatches
+  # every instance of it already queued. Returns the number of signals handled.
+  def self.dispatch_signals(signal, timeout_msec = nil)
+    n = 0
+    info = sigwaitinfo(signal, timeout_msec)
+    while info
+      dispatch(info)
+      n += 1
+      info = sigwaitinfo(signal, 0)
+    end
+    n
+  end
+end
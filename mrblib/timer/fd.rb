@@ -0,0 +1,14 @@
+module Timer
+  if const_defined?(:FD)
+    class FD
+      def inspect
+        return "#<Timer::FD closed>" if closed?
+        "#<Timer::FD fd=#{self.fileno}, clock_id=#{self.clock_id}, running=#{self.running?}>"
+      end
+
+      alias run start
+      alias fd fileno
+      alias to_i fileno
+    end
+  end
+end
@@ -0,0 +1,165 @@
+module Timer
+  # Runs fibers on the calling thread. A sleeping or waiting fiber is parked
+  # on a Timer::DeadlineSet (the C heap behind one kernel timer) and resumed
+  # once its deadline passes, so thousands of waits share one thread and the
+  # loop only sleeps until the earliest one. A woken fiber's deadline is
+  # deleted, it never holds the loop.
+  class FiberScheduler
+    # run has nothing left but fibers waiting for #wake without a deadline
+    class DeadlockError < StandardError; end
+
+    def self.current
+      @current
+    end
+
+    def self.current=(scheduler)
+      @current = scheduler
+    end
+
+    def initialize
+      @deadlines = DeadlineSet.new(signal: nil, clock_id: CLOCK_MONOTONIC)
+      @ready = []     # [fiber, resume value]
+      @parked = {}    # fiber => handle of its deadline, nil when it waits without one
+      @handles = {}   # handle => fiber
+      @fibers = {}    # fibers of this scheduler still alive
+      @scopes = {}    # fiber => deadlines of its open timeout scopes
+    end
+
+    def spawn(&block)
+      raise ArgumentError, "no block given" unless block
+      f = Fiber.new { block.call }
+      @fibers[f] = true
+      @ready << [f, nil]
+      f
+    end
+
+    # true while the calling fiber belongs to this scheduler
+    def fiber?
+      @fibers.key?(Fiber.current)
+    end
+
+    # Resumes fibers until none is ready or parked on a deadline. Raises
+    # DeadlockError when fibers are still parked by wait(nil) then, as only
+    # #wake from this thread could resume them; they stay parked, so a later
+    # #wake and #run go on.
+    def run
+      prev = FiberScheduler.current
+      FiberScheduler.current = self
+      until @ready.empty? && @deadlines.size == 0
+        until @ready.empty?
+          f, value = @ready.shift
+          f.resume(value)
+          @fibers.delete(f) unless f.alive?
+        end
+        expire
+        if @ready.empty? && @deadlines.size > 0
+          # nothing else can make a fiber ready on this thread
+          gap = @deadlines.next_deadline_ns - @deadlines.now_ns
+          usleep((gap + 999) / 1000) if gap > 0
+          expire
+        end
+      end
+      unless @parked.empty?
+        raise DeadlockError, "#{@parked.size} fiber(s) wait forever, no fiber left to wake them"
+      end
+      self
+    ensure
+      FiberScheduler.current = prev
+    end
+
+    def sleep(msec)
+      park_until(now_ns + msec * 1_000_000)
+      nil
+    end
+
+    # Parks until #wake or msec (forever with nil), true when woken
+    def wait(msec = nil)
+      park_until(msec && now_ns + msec * 1_000_000) == :woken
+    end
+
+    def wake(fiber)
+      return false unless @parked.key?(fiber)
+      handle = @parked.delete(fiber)
+      if handle
+        @deadlines.delete(handle)
+        @handles.delete(handle)
+      end
+      @ready << [fiber, :woken]
+      true
+    end
+
+    # Raises Timer::TimeoutError in the fiber when it is parked past msec,
+    # or when the block returns late
+    def timeout(msec)
+      f = Fiber.current
+      deadline = now_ns + msec * 1_000_000
+      (@scopes[f] ||= []) << deadline
+      begin
+        ret = yield(msec)
+      ensure
+        scopes = @scopes[f]
+        scopes.delete_at(scopes.rindex(deadline))
+        @scopes.delete(f) if scopes.empty?
+      end
+      raise TimeoutError, "execution expired" if now_ns >= deadline
+      ret
+    end
+
+    # fibers waiting on a deadline or for #wake
+    def parked
+      @parked.size
+    end
+
+    def inspect
+      "#<Timer::FiberScheduler fibers=#{@fibers.size}, parked=#{@parked.size}>"
+    end
+
+    private
+
+    def now_ns
+      Timer.clock_gettime_ns(Timer::CLOCK_MONOTONIC)
+    end
+
+    def park_until(deadline)
+      scopes = @scopes[Fiber.current]
+      scope = scopes && scopes.min
+      if scope && (deadline.nil? || scope < deadline)
+        raise TimeoutError, "execution expired" if park(scope) == :timeout
+        return :woken
+      end
+      park(deadline)
+    end
+
+    def park(deadline)
+      raise FiberError, "not a fiber of this scheduler" unless fiber?
+      f = Fiber.current
+      handle = nil
+      if deadline
+        handle = @deadlines.add_at(deadline)
+        @handles[handle] = f
+      end
+      @parked[f] = handle
+      Fiber.yield
+    end
+
+    def expire
+      @deadlines.expire.each do |handle|
+        f = @handles.delete(handle)
+        @parked.delete(f)
+        @ready << [f, :timeout]
+      end
+    end
+  end
+
+  # Sleeps the calling fiber when it runs under a Timer::FiberScheduler,
+  # the whole thread otherwise
+  def self.sleep_fiber(msec)
+    scheduler = FiberScheduler.current
+    if scheduler && scheduler.fiber?
+      scheduler.sleep(msec)
+    else
+      usleep(msec * 1000)
+    end
+    nil
+  end
+end
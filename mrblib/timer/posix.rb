@@ -1,21 +1,17 @@
 module Timer
   class POSIX
-    def interval?
-      s = __status_raw
-      s["interval.sec"] != 0 || s["interval.nsec"] != 0
-    end
-
-    def stopped?
-      s = __status_raw
-      s["value.sec"] == 0 && s["value.nsec"] == 0
+    # interval?, stopped?, remaining_ns and interval_ns are implemented in C
+    def seconds_left
+      remaining_ns / 1_000_000_000.0
     end
 
-    def seconds_left
-      s = __status_raw
-      s["value.sec"] + s["value.nsec"] / 1_000_000_000.0
+    # Float seconds, e.g. start_sec 0.0005, 0.0005
+    def start_sec(start, interval = 0)
+      start_ns (start * 1_000_000_000).to_i, (interval * 1_000_000_000).to_i
     end
 
     def inspect
+      return "#<Timer::POSIX closed>" if closed?
       "#<Timer::POSIX signo=#{self.signo.inspect}, clock_id=#{self.clock_id}, running=#{self.running?}, interval timer=#{self.interval?}>"
     rescue
       "#<Timer::POSIX !not available on this platform>"
@@ -0,0 +1,26 @@
+module Timer
+  class Profiler
+    # Profile the block, returns the folded stacks
+    def self.profile(opts = {})
+      prof = new(opts)
+      prof.start
+      begin
+        yield
+      ensure
+        prof.stop
+      end
+      prof.folded
+    end
+
+    # "outer;inner count" lines, as flamegraph.pl takes them
+    def folded
+      report.map {|stack, count| "#{stack} #{count}" }.join("\n")
+    end
+
+    def inspect
+      "#<Timer::Profiler running=#{self.running?}, samples=#{self.samples}, dropped=#{self.dropped}, skipped=#{self.skipped}>"
+    rescue
+      "#<Timer::Profiler !not available on this platform>"
+    end
+  end
+end
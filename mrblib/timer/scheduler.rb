@@ -0,0 +1,15 @@
+module Timer
+  class Scheduler
+    # run, run_with_signal, stop, running? and wait are implemented in C
+    def blocking_handler
+      wait
+      yield
+    end
+
+    def inspect
+      "#<Timer::Scheduler running=#{self.running?}>"
+    rescue
+      "#<Timer::Scheduler !not available on this platform>"
+    end
+  end
+end
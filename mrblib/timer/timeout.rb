@@ -0,0 +1,21 @@
+module Timer
+  # Bounds a block of work by msec, raises Timer::TimeoutError once the
+  # deadline has passed: when the block returns or at Timer.check_timeout,
+  # and with Timer::TIMEOUT_INTERRUPTS at the next VM instruction of the
+  # block. Without it a block that never returns is not bounded. The expiry
+  # signal makes a blocking system call of the thread fail with EINTR.
+  # Scopes nest, only the earliest deadline of the thread is armed.
+  def self.timeout(msec)
+    return yield(msec) if msec.nil?
+
+    token = __timeout_push(msec)
+    expired = false
+    begin
+      ret = yield(msec)
+    ensure
+      expired = __timeout_pop(token)
+    end
+    raise TimeoutError, "execution expired" if expired
+    ret
+  end
+end
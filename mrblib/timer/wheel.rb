@@ -0,0 +1,11 @@
+module Timer
+  class Wheel
+    def inspect
+      "#<Timer::Wheel signo=#{self.signo.inspect}, running=#{self.running?}>"
+    rescue
+      "#<Timer::Wheel !not available on this platform>"
+    end
+
+    alias run start
+  end
+end
@@ -0,0 +1,403 @@
+#define _GNU_SOURCE 1
+
+#include <mruby.h>
+#include <mruby/class.h>
+#include <mruby/data.h>
+#include <mruby/error.h>
+#include <mruby/hash.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "timer_thread.h"
+
+#ifndef __APPLE__
+
+/*
+ * TimerThread (Timer::MRubyThread) runs each timer on a plain pthread that
+ * sleeps in one pthread_cond_timedwait on CLOCK_MONOTONIC until the deadline,
+ * instead of an mruby Thread polling usleep every msec. blocking_handler
+ * waits on the same condition variable.
+ *
+ * The state is shared by the Ruby object and the worker, and freed by
+ * whichever lets go last, so a fire-and-forget run_with_signal survives GC.
+ *
+ * With precision: :spin the worker wakes a little before the deadline and
+ * busy-polls clock_gettime (vDSO) for the rest, at most spin_usec. How far
+ * ahead it wakes follows the overshoot of the timed waits seen so far.
+ */
+
+#define THREAD_SPIN_USEC_DEFAULT 100
+
+/* running average of how late pthread_cond_timedwait returns, relaxed */
+static uint64_t thread_wake_ewma_ns = 20000;
+
+struct mrb_timer_thread_state {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int refs;
+  int running;
+  struct timespec deadline;
+  int signo; /* 0 sends no signal */
+  int has_thread;
+  pthread_t thread_id;
+  uint64_t spin_ns; /* 0 sleeps all the way */
+  int err; /* of pthread_cond_timedwait, the timer did not fire */
+};
+
+typedef struct {
+  struct mrb_timer_thread_state *state;
+  mrb_int retry_timer_usec;
+  uint64_t spin_ns;
+} mrb_timer_thread_data;
+
+static uint64_t thread_ts_to_ns(const struct timespec *ts)
+{
+  return (uint64_t)ts->tv_sec * 1000000000ULL + (uint64_t)ts->tv_nsec;
+}
+
+static uint64_t thread_clock_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return thread_ts_to_ns(&ts);
+}
+
+static void thread_cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+static void mrb_timer_thread_state_release(struct mrb_timer_thread_state *st)
+{
+  int refs;
+
+  pthread_mutex_lock(&st->lock);
+  refs = --st->refs;
+  pthread_mutex_unlock(&st->lock);
+
+  if (!refs) {
+    pthread_cond_destroy(&st->cond);
+    pthread_mutex_destroy(&st->lock);
+    free(st);
+  }
+}
+
+static void *mrb_timer_thread_func(void *arg)
+{
+  struct mrb_timer_thread_state *st = (struct mrb_timer_thread_state *)arg;
+  struct timespec wake = st->deadline;
+  uint64_t deadline_ns = 0, wake_ns = 0, lead_ns, now_ns, ewma;
+  int rc = 0;
+
+  if (st->spin_ns) {
+    deadline_ns = thread_ts_to_ns(&st->deadline);
+    lead_ns = 2 * __atomic_load_n(&thread_wake_ewma_ns, __ATOMIC_RELAXED);
+    if (lead_ns > st->spin_ns) {
+      lead_ns = st->spin_ns;
+    }
+    wake_ns = deadline_ns > lead_ns ? deadline_ns - lead_ns : 0;
+    wake.tv_sec = (time_t)(wake_ns / 1000000000ULL);
+    wake.tv_nsec = (long)(wake_ns % 1000000000ULL);
+  }
+
+  pthread_mutex_lock(&st->lock);
+  do {
+    rc = pthread_cond_timedwait(&st->cond, &st->lock, &wake);
+  } while (rc == 0 || rc == EINTR);
+  if (rc != ETIMEDOUT) {
+    /* nothing is sent, wait raises it */
+    st->err = rc;
+    goto done;
+  }
+  if (st->spin_ns) {
+    /* spin unlocked, running? and wait must not stall behind it */
+    pthread_mutex_unlock(&st->lock);
+    now_ns = thread_clock_ns();
+    ewma = __atomic_load_n(&thread_wake_ewma_ns, __ATOMIC_RELAXED);
+    ewma = ewma - ewma / 8 + (now_ns > wake_ns ? now_ns - wake_ns : 0) / 8;
+    __atomic_store_n(&thread_wake_ewma_ns, ewma, __ATOMIC_RELAXED);
+    while (now_ns < deadline_ns) {
+      thread_cpu_relax();
+      now_ns = thread_clock_ns();
+    }
+    pthread_mutex_lock(&st->lock);
+  }
+  if (st->signo > 0) {
+    if (st->has_thread) {
+      pthread_kill(st->thread_id, st->signo);
+    } else {
+      kill(getpid(), st->signo);
+    }
+  }
+  mrb_timer_metric_add(MRB_TIMER_METRIC_FIRES, 1);
+
+done:
+  st->running = 0;
+  pthread_cond_broadcast(&st->cond);
+  pthread_mutex_unlock(&st->lock);
+
+  mrb_timer_thread_state_release(st);
+  return NULL;
+}
+
+static void mrb_timer_thread_free(mrb_state *mrb, void *p)
+{
+  mrb_timer_thread_data *data = (mrb_timer_thread_data *)p;
+  if (!data) {
+    return;
+  }
+  /* a running timer still fires, the worker holds its own reference */
+  if (data->state) {
+    mrb_timer_thread_state_release(data->state);
+  }
+  mrb_free(mrb, data);
+  mrb_timer_metric_add(MRB_TIMER_METRIC_LIVE_THREAD, -1);
+}
+
+static const struct mrb_data_type mrb_timer_thread_data_type = {"mrb_timer_thread_data", mrb_timer_thread_free};
+
+/*
+ * initialize(retry_timer_usec = 1000, precision: :sleep, spin_usec: 100),
+ * retry_timer_usec is deprecated: only the MacOS fallback polls, here it
+ * warns and is ignored
+ */
+static mrb_value mrb_timer_thread_init(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_thread_data *data;
+  mrb_value arg1 = mrb_nil_value(), arg2 = mrb_nil_value(), options = mrb_nil_value(), v;
+  mrb_int retry_timer_usec = 1000, spin_usec = THREAD_SPIN_USEC_DEFAULT;
+  int spin = 0;
+
+  if (mrb_get_args(mrb, "|oo", &arg1, &arg2) == -1) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot get arguments");
+  }
+  if (mrb_hash_p(arg1)) {
+    options = arg1;
+  } else {
+    if (!mrb_nil_p(arg1)) {
+      retry_timer_usec = mrb_fixnum(mrb_to_int(mrb, arg1));
+      mrb_warn(mrb, "TimerThread: retry_timer_usec is deprecated and ignored, the worker never polls");
+    }
+    options = arg2;
+  }
+  if (mrb_hash_p(options)) {
+    v = mrb_hash_get(mrb, options, mrb_symbol_value(mrb_intern_lit(mrb, "precision")));
+    if (mrb_symbol_p(v) && mrb_symbol(v) == mrb_intern_lit(mrb, "spin")) {
+      spin = 1;
+    } else if (!mrb_nil_p(v) && !(mrb_symbol_p(v) && mrb_symbol(v) == mrb_intern_lit(mrb, "sleep"))) {
+      mrb_raise(mrb, E_ARGUMENT_ERROR, "precision must be :sleep or :spin");
+    }
+    v = mrb_hash_get(mrb, options, mrb_symbol_value(mrb_intern_lit(mrb, "spin_usec")));
+    if (!mrb_nil_p(v)) {
+      spin_usec = mrb_fixnum(mrb_to_int(mrb, v));
+      if (spin_usec <= 0) {
+        mrb_raise(mrb, E_ARGUMENT_ERROR, "spin_usec must be positive");
+      }
+    }
+  }
+
+  data = (mrb_timer_thread_data *)DATA_PTR(self);
+  if (data) {
+    mrb_timer_thread_free(mrb, data);
+  }
+  DATA_TYPE(self) = &mrb_timer_thread_data_type;
+  DATA_PTR(self) = NULL;
+
+  data = (mrb_timer_thread_data *)mrb_malloc(mrb, sizeof(mrb_timer_thread_data));
+  data->state = NULL;
+  data->retry_timer_usec = retry_timer_usec;
+  data->spin_ns = spin ? (uint64_t)spin_usec * 1000ULL : 0;
+  mrb_timer_metric_add(MRB_TIMER_METRIC_LIVE_THREAD, 1);
+
+  DATA_PTR(self) = data;
+  return self;
+}
+
+static void mrb_timer_thread_spawn(mrb_state *mrb, mrb_value self, mrb_int msec, int signo, int has_thread,
+                                   pthread_t thread_id)
+{
+  mrb_timer_thread_data *data = DATA_PTR(self);
+  struct mrb_timer_thread_state *st;
+  pthread_condattr_t attr;
+  pthread_attr_t tattr;
+  pthread_t th;
+  int err;
+
+  if (msec < 0) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "Values must be 0 or positive");
+  }
+
+  st = (struct mrb_timer_thread_state *)malloc(sizeof(struct mrb_timer_thread_state));
+  if (!st) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot allocate timer thread");
+  }
+  pthread_mutex_init(&st->lock, NULL);
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&st->cond, &attr);
+  pthread_condattr_destroy(&attr);
+  st->refs = 2; /* this object and the worker */
+  st->running = 1;
+  st->signo = signo;
+  st->has_thread = has_thread;
+  st->thread_id = thread_id;
+  st->spin_ns = data->spin_ns;
+  st->err = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &st->deadline);
+  st->deadline.tv_sec += (time_t)(msec / 1000);
+  st->deadline.tv_nsec += (long)((msec % 1000) * 1000000);
+  if (st->deadline.tv_nsec >= 1000000000L) {
+    st->deadline.tv_sec++;
+    st->deadline.tv_nsec -= 1000000000L;
+  }
+
+  pthread_attr_init(&tattr);
+  pthread_attr_setdetachstate(&tattr, PTHREAD_CREATE_DETACHED);
+  err = pthread_create(&th, &tattr, mrb_timer_thread_func, st);
+  pthread_attr_destroy(&tattr);
+  if (err) {
+    pthread_cond_destroy(&st->cond);
+    pthread_mutex_destroy(&st->lock);
+    free(st);
+    errno = err;
+    mrb_sys_fail(mrb, "pthread_create");
+  }
+
+  /* like a new Thread per run, a previous timer keeps going on its own */
+  if (data->state) {
+    mrb_timer_thread_state_release(data->state);
+  }
+  data->state = st;
+  mrb_timer_metric_add(MRB_TIMER_METRIC_ARMS, 1);
+}
+
+static mrb_value mrb_timer_thread_run(mrb_state *mrb, mrb_value self)
+{
+  mrb_int msec;
+
+  if (mrb_get_args(mrb, "i", &msec) == -1) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot get arguments");
+  }
+  mrb_timer_thread_spawn(mrb, self, msec, 0, 0, 0);
+
+  return self;
+}
+
+/* thread_id is a SignalThread#thread_id, the whole process is signalled without it */
+static mrb_value mrb_timer_thread_run_with_signal(mrb_state *mrb, mrb_value self)
+{
+  mrb_int msec;
+  mrb_value signal, thread_id_arg = mrb_nil_value();
+  pthread_t thread_id = 0;
+  int signo, has_thread = 0;
+
+  if (mrb_get_args(mrb, "io|o", &msec, &signal, &thread_id_arg) == -1) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot get arguments");
+  }
+
+  signo = mrb_timer_to_signo(mrb, signal);
+  if (signo <= 0) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "Invalid value for signal");
+  }
+  if (mrb_float_p(thread_id_arg)) {
+    thread_id = (pthread_t)mrb_float(thread_id_arg);
+    has_thread = 1;
+  } else if (mrb_fixnum_p(thread_id_arg)) {
+    thread_id = (pthread_t)mrb_fixnum(thread_id_arg);
+    has_thread = 1;
+  }
+  mrb_timer_thread_spawn(mrb, self, msec, signo, has_thread, thread_id);
+
+  return self;
+}
+
+static mrb_value mrb_timer_thread_is_running(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_thread_data *data = DATA_PTR(self);
+  struct mrb_timer_thread_state *st = data->state;
+  int running;
+
+  if (!st) {
+    return mrb_false_value();
+  }
+  pthread_mutex_lock(&st->lock);
+  running = st->running;
+  pthread_mutex_unlock(&st->lock);
+
+  return mrb_bool_value(running);
+}
+
+/* Block until the current timer has fired, raises when the worker could not wait for it */
+static mrb_value mrb_timer_thread_wait(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_thread_data *data = DATA_PTR(self);
+  struct mrb_timer_thread_state *st = data->state;
+  int err;
+
+  if (!st) {
+    return self;
+  }
+  pthread_mutex_lock(&st->lock);
+  while (st->running) {
+    pthread_cond_wait(&st->cond, &st->lock);
+  }
+  err = st->err;
+  pthread_mutex_unlock(&st->lock);
+
+  if (err) {
+    errno = err;
+    mrb_sys_fail(mrb, "pthread_cond_timedwait");
+  }
+
+  return self;
+}
+
+/* deprecated, the value given to initialize */
+static mrb_value mrb_timer_thread_retry_timer_usec(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_thread_data *data = DATA_PTR(self);
+  return mrb_fixnum_value(data->retry_timer_usec);
+}
+
+static mrb_value mrb_timer_thread_precision(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_thread_data *data = DATA_PTR(self);
+  return mrb_symbol_value(data->spin_ns ? mrb_intern_lit(mrb, "spin") : mrb_intern_lit(mrb, "sleep"));
+}
+
+/* spin budget in usec, nil with precision: :sleep */
+static mrb_value mrb_timer_thread_spin_usec(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_thread_data *data = DATA_PTR(self);
+  return data->spin_ns ? mrb_fixnum_value((mrb_int)(data->spin_ns / 1000)) : mrb_nil_value();
+}
+
+void mrb_timer_define_thread(mrb_state *mrb)
+{
+  struct RClass *th;
+
+  th = mrb_define_class(mrb, "TimerThread", mrb->object_class);
+  MRB_SET_INSTANCE_TT(th, MRB_TT_DATA);
+  mrb_define_method(mrb, th, "initialize", mrb_timer_thread_init, MRB_ARGS_OPT(2));
+  mrb_define_method(mrb, th, "run", mrb_timer_thread_run, MRB_ARGS_REQ(1));
+  mrb_define_method(mrb, th, "run_with_signal", mrb_timer_thread_run_with_signal, MRB_ARGS_ARG(2, 1));
+  mrb_define_method(mrb, th, "running?", mrb_timer_thread_is_running, MRB_ARGS_NONE());
+  mrb_define_method(mrb, th, "wait", mrb_timer_thread_wait, MRB_ARGS_NONE());
+  mrb_define_method(mrb, th, "retry_timer_usec", mrb_timer_thread_retry_timer_usec, MRB_ARGS_NONE());
+  mrb_define_method(mrb, th, "precision", mrb_timer_thread_precision, MRB_ARGS_NONE());
+  mrb_define_method(mrb, th, "spin_usec", mrb_timer_thread_spin_usec, MRB_ARGS_NONE());
+}
+
+#endif
@@ -0,0 +1,495 @@
+#define _GNU_SOURCE 1
+
+#include <mruby.h>
+#include <mruby/array.h>
+#include <mruby/class.h>
+#include <mruby/data.h>
+#include <mruby/error.h>
+#include <mruby/hash.h>
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "timer_thread.h"
+
+#ifndef __APPLE__
+
+/*
+ * Timer::DeadlineSet keeps any number of deadlines behind one kernel timer.
+ *
+ * The deadlines live in a 4-ary min-heap laid out as a struct of arrays:
+ * keys[i] is the absolute nsec deadline of handles[i], pos[handle] is its
+ * heap index. Every live handle is in the heap, so an entry costs 16 bytes.
+ * Free handles chain through pos, tagged with DSET_FREE; a handle is
+ * reused once it has expired or been deleted.
+ *
+ * The kernel timer is armed with TIMER_ABSTIME at the minimum. It signals
+ * with the set's id in sival_int, so Timer.register / Timer.wait_any work
+ * with it.
+ *
+ * delete only tombstones the entry (DSET_TOMBSTONE in handles[], which
+ * moves with it), O(1) and without a syscall. Tombstones are dropped when
+ * they reach the front, or all at once when they outnumber the live
+ * entries. The kernel timer is only re-armed for a new earliest deadline
+ * and by expire, so a cancelled front entry costs at most one early wakeup.
+ */
+
+#define DSET_ARITY 4
+#define DSET_FREE 0x80000000U      /* in pos[] */
+#define DSET_TOMBSTONE 0x80000000U /* in handles[] */
+#define DSET_HANDLE(v) ((v) & ~DSET_TOMBSTONE)
+#define DSET_END 0x7fffffffU /* end of the free chain */
+#define DSET_MAX_HANDLES DSET_END
+#define DSET_COMPACT_MIN 64
+
+typedef struct {
+  uint64_t *keys;
+  uint32_t *handles;
+  uint32_t *pos;
+  uint32_t len;
+  uint32_t dead; /* tombstones in the heap */
+  uint32_t capa;
+  uint32_t free_head;
+  uint32_t id;
+  clockid_t clockid;
+  int signo; /* 0 for signal: nil */
+  timer_t timer;
+  uint64_t armed_ns; /* 0 while disarmed */
+} mrb_timer_dset;
+
+static void mrb_timer_dset_free(mrb_state *mrb, void *p)
+{
+  mrb_timer_dset *set = (mrb_timer_dset *)p;
+
+  if (!set) {
+    return;
+  }
+  timer_delete(set->timer);
+  mrb_timer_metric_add(MRB_TIMER_METRIC_LIVE_DEADLINE_SETS, -1);
+  mrb_timer_metric_add(MRB_TIMER_METRIC_LIVE_DEADLINES, -(int64_t)(set->len - set->dead));
+  mrb_free(mrb, set->keys);
+  mrb_free(mrb, set->handles);
+  mrb_free(mrb, set->pos);
+  mrb_free(mrb, set);
+}
+
+static const struct mrb_data_type mrb_timer_dset_data_type = {"mrb_timer_deadline_set", mrb_timer_dset_free};
+
+static uint64_t dset_clock_ns(mrb_timer_dset *set)
+{
+  struct timespec ts;
+  clock_gettime(set->clockid, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* h may carry DSET_TOMBSTONE */
+static void dset_place(mrb_timer_dset *set, uint32_t i, uint64_t key, uint32_t h)
+{
+  set->keys[i] = key;
+  set->handles[i] = h;
+  set->pos[DSET_HANDLE(h)] = i;
+}
+
+static void dset_sift_up(mrb_timer_dset *set, uint32_t i)
+{
+  uint64_t key = set->keys[i];
+  uint32_t h = set->handles[i], parent;
+
+  while (i > 0) {
+    parent = (i - 1) / DSET_ARITY;
+    if (set->keys[parent] <= key) {
+      break;
+    }
+    dset_place(set, i, set->keys[parent], set->handles[parent]);
+    i = parent;
+  }
+  dset_place(set, i, key, h);
+}
+
+static void dset_sift_down(mrb_timer_dset *set, uint32_t i)
+{
+  uint64_t key = set->keys[i];
+  uint32_t h = set->handles[i], first, last, child, min;
+
+  for (;;) {
+    first = i * DSET_ARITY + 1;
+    if (first >= set->len) {
+      break;
+    }
+    last = first + DSET_ARITY < set->len ? first + DSET_ARITY : set->len;
+    /* the children are adjacent in keys[], one cache line for all four */
+    min = first;
+    for (child = first + 1; child < last; child++) {
+      if (set->keys[child] < set->keys[min]) {
+        min = child;
+      }
+    }
+    if (set->keys[min] >= key) {
+      break;
+    }
+    dset_place(set, i, set->keys[min], set->handles[min]);
+    i = min;
+  }
+  dset_place(set, i, key, h);
+}
+
+/* Take the entry at heap index i out and give its handle back */
+static void dset_remove_at(mrb_timer_dset *set, uint32_t i)
+{
+  uint32_t h = DSET_HANDLE(set->handles[i]), moved;
+
+  if (set->handles[i] & DSET_TOMBSTONE) {
+    set->dead--;
+  }
+  set->len--;
+  if (i < set->len) {
+    moved = set->handles[set->len];
+    dset_place(set, i, set->keys[set->len], moved);
+    dset_sift_down(set, i);
+    dset_sift_up(set, set->pos[DSET_HANDLE(moved)]);
+  }
+  set->pos[h] = DSET_FREE | set->free_head;
+  set->free_head = h;
+}
+
+/* Drop the tombstones at the front, so that keys[0] is the earliest live deadline */
+static void dset_prune(mrb_timer_dset *set)
+{
+  while (set->len && (set->handles[0] & DSET_TOMBSTONE)) {
+    dset_remove_at(set, 0);
+  }
+}
+
+/* Drop every tombstone and heapify the rest, O(n) */
+static void dset_compact(mrb_timer_dset *set)
+{
+  uint32_t i, n = 0, h;
+
+  for (i = 0; i < set->len; i++) {
+    h = set->handles[i];
+    if (h & DSET_TOMBSTONE) {
+      set->pos[DSET_HANDLE(h)] = DSET_FREE | set->free_head;
+      set->free_head = DSET_HANDLE(h);
+    } else {
+      dset_place(set, n++, set->keys[i], h);
+    }
+  }
+  set->len = n;
+  set->dead = 0;
+  for (i = n / DSET_ARITY + 1; i-- > 0;) {
+    if (i < n) {
+      dset_sift_down(set, i);
+    }
+  }
+}
+
+/* pending and not deleted */
+static int dset_live(mrb_timer_dset *set, mrb_int h)
+{
+  return h >= 0 && (uint64_t)h < set->capa && !(set->pos[h] & DSET_FREE) &&
+         !(set->handles[set->pos[h]] & DSET_TOMBSTONE);
+}
+
+static void dset_rearm(mrb_state *mrb, mrb_timer_dset *set)
+{
+  uint64_t target = set->len ? set->keys[0] : 0;
+  struct itimerspec ts;
+
+  if (target == set->armed_ns) {
+    return;
+  }
+  memset(&ts, 0, sizeof(struct itimerspec));
+  ts.it_value.tv_sec = (time_t)(target / 1000000000ULL);
+  ts.it_value.tv_nsec = (long)(target % 1000000000ULL);
+  if (timer_settime(set->timer, TIMER_ABSTIME, &ts, NULL) == -1) {
+    mrb_sys_fail(mrb, "timer_settime");
+  }
+  set->armed_ns = target;
+}
+
+static void dset_grow(mrb_state *mrb, mrb_timer_dset *set)
+{
+  uint32_t capa = set->capa ? set->capa * 2 : 64, h;
+
+  if (capa > DSET_MAX_HANDLES || capa < set->capa) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Too many deadlines");
+  }
+  set->keys = (uint64_t *)mrb_realloc(mrb, set->keys, sizeof(uint64_t) * capa);
+  set->handles = (uint32_t *)mrb_realloc(mrb, set->handles, sizeof(uint32_t) * capa);
+  set->pos = (uint32_t *)mrb_realloc(mrb, set->pos, sizeof(uint32_t) * capa);
+  /* chain the new handles, lowest first */
+  for (h = capa; h-- > set->capa;) {
+    set->pos[h] = DSET_FREE | set->free_head;
+    set->free_head = h;
+  }
+  set->capa = capa;
+}
+
+static mrb_value dset_insert(mrb_state *mrb, mrb_value self, uint64_t deadline_ns)
+{
+  mrb_timer_dset *set = DATA_PTR(self);
+  uint32_t h, i;
+
+  if (set->free_head == DSET_END) {
+    dset_grow(mrb, set);
+  }
+  h = set->free_head;
+  set->free_head = set->pos[h] & ~DSET_FREE;
+  i = set->len++;
+  dset_place(set, i, deadline_ns, h);
+  dset_sift_up(set, i);
+  if (set->pos[h] == 0) {
+    dset_rearm(mrb, set);
+  }
+  mrb_timer_metric_add(MRB_TIMER_METRIC_LIVE_DEADLINES, 1);
+  mrb_timer_metric_add(MRB_TIMER_METRIC_ARMS, 1);
+  return mrb_fixnum_value((mrb_int)h);
+}
+
+/* initialize(signal: SIGALRM, clock_id: CLOCK_MONOTONIC), signal: nil only keeps the books */
+static mrb_value mrb_timer_dset_init(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_dset *set;
+  mrb_value options = mrb_nil_value(), v;
+  struct sigevent sev;
+  clockid_t clockid = CLOCK_MONOTONIC;
+  int signo = SIGALRM;
+
+  if (mrb_get_args(mrb, "|o", &options) == -1) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot get arguments");
+  }
+  if (mrb_hash_p(options)) {
+    v = mrb_hash_fetch(mrb, options, mrb_symbol_value(mrb_intern_lit(mrb, "signal")), mrb_undef_value());
+    if (mrb_nil_p(v)) {
+      signo = 0;
+    } else if (!mrb_undef_p(v)) {
+      signo = mrb_timer_to_signo(mrb, v);
+      if (signo <= 0) {
+        mrb_raise(mrb, E_ARGUMENT_ERROR, "Invalid value for signal");
+      }
+    }
+    v = mrb_hash_get(mrb, options, mrb_symbol_value(mrb_intern_lit(mrb, "clock_id")));
+    if (!mrb_nil_p(v)) {
+      clockid = (clockid_t)mrb_fixnum(mrb_to_int(mrb, v));
+    }
+  }
+
+  set = (mrb_timer_dset *)DATA_PTR(self);
+  if (set) {
+    mrb_timer_dset_free(mrb, set);
+  }
+  DATA_TYPE(self) = &mrb_timer_dset_data_type;
+  DATA_PTR(self) = NULL;
+
+  set = (mrb_timer_dset *)mrb_malloc(mrb, sizeof(mrb_timer_dset));
+  memset(set, 0, sizeof(mrb_timer_dset));
+  set->free_head = DSET_END;
+  set->id = mrb_timer_next_id();
+  set->clockid = clockid;
+  set->signo = signo;
+
+  memset(&sev, 0, sizeof(struct sigevent));
+  if (signo) {
+    sev.sigev_notify = SIGEV_SIGNAL;
+    sev.sigev_signo = signo;
+    sev.sigev_value.sival_int = (int)set->id;
+  } else {
+    sev.sigev_notify = SIGEV_NONE;
+  }
+  if (timer_create(clockid, &sev, &set->timer) == -1) {
+    int err = errno;
+    mrb_free(mrb, set);
+    errno = err;
+    mrb_sys_fail(mrb, "timer_create failed");
+  }
+  mrb_timer_metric_add(MRB_TIMER_METRIC_LIVE_DEADLINE_SETS, 1);
+
+  DATA_PTR(self) = set;
+  return self;
+}
+
+/* add(msec) => handle, expiring msec from now */
+static mrb_value mrb_timer_dset_add(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_dset *set = DATA_PTR(self);
+  mrb_int msec;
+
+  if (mrb_get_args(mrb, "i", &msec) == -1) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot get arguments");
+  }
+  if (msec < 0) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "Values must be 0 or positive");
+  }
+  return dset_insert(mrb, self, dset_clock_ns(set) + (uint64_t)msec * 1000000ULL);
+}
+
+/* add_at(deadline_ns) => handle, deadline_ns is absolute on the set's clock */
+static mrb_value mrb_timer_dset_add_at(mrb_state *mrb, mrb_value self)
+{
+  mrb_int deadline;
+
+  if (mrb_get_args(mrb, "i", &deadline) == -1) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot get arguments");
+  }
+  /* 0 would disarm the kernel timer */
+  if (deadline <= 0) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "Deadline must be positive");
+  }
+  return dset_insert(mrb, self, (uint64_t)deadline);
+}
+
+/* Tombstone a pending handle, false when it is not pending */
+static mrb_value mrb_timer_dset_delete(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_dset *set = DATA_PTR(self);
+  mrb_int h;
+
+  if (mrb_get_args(mrb, "i", &h) == -1) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot get arguments");
+  }
+  if (!dset_live(set, h)) {
+    return mrb_false_value();
+  }
+  set->handles[set->pos[h]] |= DSET_TOMBSTONE;
+  set->dead++;
+  if (set->dead >= DSET_COMPACT_MIN && set->dead > set->len / 2) {
+    dset_compact(set);
+  }
+  mrb_timer_metric_add(MRB_TIMER_METRIC_LIVE_DEADLINES, -1);
+  mrb_timer_metric_add(MRB_TIMER_METRIC_CANCELS, 1);
+  return mrb_true_value();
+}
+
+static mrb_value mrb_timer_dset_include(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_dset *set = DATA_PTR(self);
+  mrb_int h;
+
+  if (mrb_get_args(mrb, "i", &h) == -1) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot get arguments");
+  }
+  return mrb_bool_value(dset_live(set, h));
+}
+
+/* Deadline of a pending handle in nsec, nil otherwise */
+static mrb_value mrb_timer_dset_deadline_ns(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_dset *set = DATA_PTR(self);
+  mrb_int h;
+
+  if (mrb_get_args(mrb, "i", &h) == -1) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot get arguments");
+  }
+  if (!dset_live(set, h)) {
+    return mrb_nil_value();
+  }
+  return mrb_fixnum_value((mrb_int)set->keys[set->pos[h]]);
+}
+
+/* expire(max = nil) => handles whose deadline has passed, earliest first; re-arms for the rest */
+static mrb_value mrb_timer_dset_expire(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_dset *set = DATA_PTR(self);
+  mrb_value ret;
+  mrb_int max = -1, n = 0;
+  uint64_t now;
+
+  if (mrb_get_args(mrb, "|i", &max) == -1) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot get arguments");
+  }
+
+  ret = mrb_ary_new(mrb);
+  now = dset_clock_ns(set);
+  for (dset_prune(set); set->len && set->keys[0] <= now && n != max; dset_prune(set)) {
+    mrb_ary_push(mrb, ret, mrb_fixnum_value((mrb_int)set->handles[0]));
+    dset_remove_at(set, 0);
+    n++;
+  }
+  dset_rearm(mrb, set);
+  if (n) {
+    mrb_timer_metric_add(MRB_TIMER_METRIC_LIVE_DEADLINES, -(int64_t)n);
+    mrb_timer_metric_add(MRB_TIMER_METRIC_FIRES, (int64_t)n);
+  }
+  return ret;
+}
+
+static mrb_value mrb_timer_dset_size(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_dset *set = DATA_PTR(self);
+  return mrb_fixnum_value((mrb_int)(set->len - set->dead));
+}
+
+/* Deleted entries still waiting to be dropped */
+static mrb_value mrb_timer_dset_tombstones(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_dset *set = DATA_PTR(self);
+  return mrb_fixnum_value((mrb_int)set->dead);
+}
+
+/* Earliest deadline in nsec, nil when empty */
+static mrb_value mrb_timer_dset_next_deadline_ns(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_dset *set = DATA_PTR(self);
+  dset_prune(set);
+  return set->len ? mrb_fixnum_value((mrb_int)set->keys[0]) : mrb_nil_value();
+}
+
+static mrb_value mrb_timer_dset_now_ns(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_dset *set = DATA_PTR(self);
+  return mrb_fixnum_value((mrb_int)dset_clock_ns(set));
+}
+
+/* Bytes allocated for the entries, capacity included */
+static mrb_value mrb_timer_dset_bytes(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_dset *set = DATA_PTR(self);
+  size_t per_entry = sizeof(uint64_t) + 2 * sizeof(uint32_t);
+  return mrb_fixnum_value((mrb_int)(sizeof(mrb_timer_dset) + per_entry * set->capa));
+}
+
+static mrb_value mrb_timer_dset_id(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_dset *set = DATA_PTR(self);
+  return mrb_fixnum_value((mrb_int)set->id);
+}
+
+static mrb_value mrb_timer_dset_signo(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_dset *set = DATA_PTR(self);
+  return set->signo ? mrb_fixnum_value(set->signo) : mrb_nil_value();
+}
+
+static mrb_value mrb_timer_dset_clockid(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_dset *set = DATA_PTR(self);
+  return mrb_fixnum_value((mrb_int)set->clockid);
+}
+
+void mrb_timer_define_deadline_set(mrb_state *mrb, struct RClass *timer)
+{
+  struct RClass *ds;
+
+  ds = mrb_define_class_under(mrb, timer, "DeadlineSet", mrb->object_class);
+  MRB_SET_INSTANCE_TT(ds, MRB_TT_DATA);
+  mrb_define_method(mrb, ds, "initialize", mrb_timer_dset_init, MRB_ARGS_OPT(1));
+  mrb_define_method(mrb, ds, "add", mrb_timer_dset_add, MRB_ARGS_REQ(1));
+  mrb_define_method(mrb, ds, "add_at", mrb_timer_dset_add_at, MRB_ARGS_REQ(1));
+  mrb_define_method(mrb, ds, "delete", mrb_timer_dset_delete, MRB_ARGS_REQ(1));
+  mrb_define_method(mrb, ds, "include?", mrb_timer_dset_include, MRB_ARGS_REQ(1));
+  mrb_define_method(mrb, ds, "deadline_ns", mrb_timer_dset_deadline_ns, MRB_ARGS_REQ(1));
+  mrb_define_method(mrb, ds, "expire", mrb_timer_dset_expire, MRB_ARGS_OPT(1));
+  mrb_define_method(mrb, ds, "size", mrb_timer_dset_size, MRB_ARGS_NONE());
+  mrb_define_method(mrb, ds, "tombstones", mrb_timer_dset_tombstones, MRB_ARGS_NONE());
+  mrb_define_method(mrb, ds, "next_deadline_ns", mrb_timer_dset_next_deadline_ns, MRB_ARGS_NONE());
+  mrb_define_method(mrb, ds, "now_ns", mrb_timer_dset_now_ns, MRB_ARGS_NONE());
+  mrb_define_method(mrb, ds, "bytes", mrb_timer_dset_bytes, MRB_ARGS_NONE());
+  mrb_define_method(mrb, ds, "id", mrb_timer_dset_id, MRB_ARGS_NONE());
+  mrb_define_method(mrb, ds, "signo", mrb_timer_dset_signo, MRB_ARGS_NONE());
+  mrb_define_method(mrb, ds, "clock_id", mrb_timer_dset_clockid, MRB_ARGS_NONE());
+}
+
+#endif
@@ -0,0 +1,291 @@
+#define _GNU_SOURCE 1
+
+#include <mruby.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "timer_thread.h"
+
+#ifdef MRB_TIMER_HAVE_DISPATCHER
+
+/*
+ * Long-lived dispatcher threads for thread targeted Timer::POSIX, one per
+ * shard (see timer_shard.c) plus the unpinned default.
+ *
+ * Instead of SIGEV_THREAD (glibc runs a fresh helper thread per expiry just
+ * to call pthread_kill), those timers notify the dispatcher directly with
+ * SIGEV_THREAD_ID. The dispatcher reaps them with sigwaitinfo and forwards to
+ * the pthread_t kept in mrb_timer_posix_thread_param, or pushes the expiry
+ * to the event queue for queue: true timers.
+ *
+ * A queued signal may outlive timer_delete, so sival_ptr carries a
+ * generation tagged slot handle instead of the param pointer itself. A slot
+ * is retired once its generation is used up (16 bits with 32 bit words), so
+ * a stale signal never matches the timer that recycled its slot.
+ */
+
+/* the handle is half index, half generation, whatever the pointer size */
+#define DISPATCH_INDEX_BITS (sizeof(uintptr_t) * 4)
+#define DISPATCH_INDEX_MASK (((uintptr_t)1 << DISPATCH_INDEX_BITS) - 1)
+
+struct mrb_timer_dispatch_slot {
+  uintptr_t gen;
+  struct mrb_timer_posix_thread_param *param; /* NULL while free */
+};
+
+struct mrb_timer_dispatcher {
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  pthread_t thread;
+  pid_t tid;
+  int signo;
+  int started;
+  int err;
+  struct mrb_timer_dispatch_slot *slots;
+  uint32_t capa;
+  uint32_t *free_list;
+  uint32_t free_len;
+  uint32_t used;
+};
+
+/* index 0 is the default, shard n is at n + 1 */
+static struct mrb_timer_dispatcher *dispatchers[MRB_TIMER_MAX_SHARDS + 1];
+static pthread_mutex_t dispatchers_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void *dispatcher_func(void *arg)
+{
+  struct mrb_timer_dispatcher *d = (struct mrb_timer_dispatcher *)arg;
+  sigset_t set;
+  siginfo_t info;
+  uintptr_t handle, idx, gen;
+  int signo, has_thread, queued;
+  uint32_t id, worker;
+  pthread_t target;
+
+  sigemptyset(&set);
+  sigaddset(&set, d->signo);
+
+  pthread_mutex_lock(&d->lock);
+  d->tid = (pid_t)syscall(SYS_gettid);
+  pthread_cond_broadcast(&d->ready);
+  pthread_mutex_unlock(&d->lock);
+
+  for (;;) {
+    if (sigwaitinfo(&set, &info) == -1) {
+      continue;
+    }
+    if (info.si_code != SI_TIMER) {
+      continue;
+    }
+    handle = (uintptr_t)info.si_value.sival_ptr;
+    idx = handle & DISPATCH_INDEX_MASK;
+    gen = handle >> DISPATCH_INDEX_BITS;
+
+    signo = 0;
+    queued = 0;
+    pthread_mutex_lock(&d->lock);
+    if (idx < d->capa && d->slots[idx].param && d->slots[idx].gen == gen) {
+      signo = d->slots[idx].param->signo;
+      has_thread = d->slots[idx].param->has_thread;
+      target = d->slots[idx].param->thread_id;
+      queued = d->slots[idx].param->queued;
+      worker = d->slots[idx].param->worker;
+      id = d->slots[idx].param->id;
+      mrb_timer_stats_record_now(&d->slots[idx].param->stats);
+    }
+    pthread_mutex_unlock(&d->lock);
+
+    if (queued) {
+      /* si_overrun counts the expirations coalesced into this signal */
+      mrb_timer_ring_push(id, 1 + (uint32_t)(info.si_overrun > 0 ? info.si_overrun : 0));
+    } else if (signo > 0 && worker) {
+      mrb_timer_worker_send_signal(worker, signo, id);
+    } else if (signo > 0) {
+      mrb_timer_send_signal(signo, has_thread, target, id);
+    }
+  }
+  return NULL;
+}
+
+static void dispatcher_start(struct mrb_timer_dispatcher *d, int shard)
+{
+  struct sigaction sa;
+  sigset_t all, old;
+  pthread_attr_t attr;
+  int err;
+
+  d->signo = MRB_TIMER_DISPATCHER_SIGNAL;
+  d->tid = 0;
+
+  /* sigwaitinfo would swallow the application's own signals */
+  sigaction(d->signo, NULL, &sa);
+  if ((sa.sa_flags & SA_SIGINFO) || sa.sa_handler != SIG_DFL) {
+    d->err = EBUSY;
+    return;
+  }
+
+  /* the dispatcher takes no other signal, and waits for its own one */
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  mrb_timer_shard_attr(&attr, shard);
+  err = pthread_create(&d->thread, &attr, dispatcher_func, d);
+  pthread_attr_destroy(&attr);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+  if (err) {
+    d->err = err;
+    return;
+  }
+
+  pthread_mutex_lock(&d->lock);
+  while (!d->tid) {
+    pthread_cond_wait(&d->ready, &d->lock);
+  }
+  pthread_mutex_unlock(&d->lock);
+}
+
+static struct mrb_timer_dispatcher *dispatcher_get(int shard)
+{
+  return dispatchers[shard + 1];
+}
+
+int mrb_timer_dispatcher_setup(int shard, pid_t *tid, int *signo)
+{
+  struct mrb_timer_dispatcher *d;
+  int err = 0;
+
+  pthread_mutex_lock(&dispatchers_lock);
+  d = dispatchers[shard + 1];
+  if (!d) {
+    d = (struct mrb_timer_dispatcher *)calloc(1, sizeof(struct mrb_timer_dispatcher));
+    if (!d) {
+      pthread_mutex_unlock(&dispatchers_lock);
+      errno = ENOMEM;
+      return -1;
+    }
+    pthread_mutex_init(&d->lock, NULL);
+    pthread_cond_init(&d->ready, NULL);
+    dispatchers[shard + 1] = d;
+  }
+  /* a failed start (EBUSY, pthread_create) is tried again by the next caller */
+  if (!d->started) {
+    d->err = 0;
+    dispatcher_start(d, shard);
+    d->started = !d->err;
+    err = d->err;
+  }
+  pthread_mutex_unlock(&dispatchers_lock);
+
+  if (err) {
+    errno = err;
+    return -1;
+  }
+  *tid = d->tid;
+  *signo = d->signo;
+  return 0;
+}
+
+uintptr_t mrb_timer_dispatcher_register(int shard, struct mrb_timer_posix_thread_param *param)
+{
+  struct mrb_timer_dispatcher *d = dispatcher_get(shard);
+  uint32_t idx;
+  uintptr_t handle = 0;
+
+  pthread_mutex_lock(&d->lock);
+  if (d->free_len) {
+    idx = d->free_list[--d->free_len];
+  } else {
+    if (d->used == d->capa) {
+      /* in uintptr_t, so that doubling cannot wrap a 32 bit capa past the limit */
+      uintptr_t capa = d->capa ? (uintptr_t)d->capa * 2 : 64;
+      struct mrb_timer_dispatch_slot *slots;
+      uint32_t *free_list;
+      if (d->capa >= DISPATCH_INDEX_MASK) {
+        goto done;
+      }
+      if (capa > DISPATCH_INDEX_MASK) {
+        capa = DISPATCH_INDEX_MASK;
+      }
+      slots = realloc(d->slots, sizeof(*slots) * capa);
+      if (!slots) {
+        goto done;
+      }
+      d->slots = slots;
+      free_list = realloc(d->free_list, sizeof(uint32_t) * capa);
+      if (!free_list) {
+        goto done;
+      }
+      d->free_list = free_list;
+      memset(d->slots + d->capa, 0, sizeof(*slots) * (capa - d->capa));
+      d->capa = (uint32_t)capa;
+    }
+    idx = d->used++;
+  }
+  /* from 1, so that no handle is 0; retired slots never come back here */
+  d->slots[idx].gen++;
+  d->slots[idx].param = param;
+  handle = (d->slots[idx].gen << DISPATCH_INDEX_BITS) | idx;
+
+done:
+  pthread_mutex_unlock(&d->lock);
+  return handle;
+}
+
+void mrb_timer_dispatcher_unregister(int shard, uintptr_t handle)
+{
+  struct mrb_timer_dispatcher *d = dispatcher_get(shard);
+  uintptr_t idx = handle & DISPATCH_INDEX_MASK;
+
+  pthread_mutex_lock(&d->lock);
+  if (idx < d->capa && d->slots[idx].param) {
+    d->slots[idx].param = NULL;
+    if (d->slots[idx].gen < DISPATCH_INDEX_MASK) {
+      d->free_list[d->free_len++] = idx;
+    }
+  }
+  pthread_mutex_unlock(&d->lock);
+}
+
+void mrb_timer_dispatcher_lock(int shard)
+{
+  pthread_mutex_lock(&dispatcher_get(shard)->lock);
+}
+
+void mrb_timer_dispatcher_unlock(int shard)
+{
+  pthread_mutex_unlock(&dispatcher_get(shard)->lock);
+}
+
+uint64_t mrb_timer_dispatcher_cpu_ns(void)
+{
+  struct timespec ts;
+  clockid_t clk;
+  uint64_t sum = 0;
+  int i;
+
+  pthread_mutex_lock(&dispatchers_lock);
+  for (i = 0; i <= MRB_TIMER_MAX_SHARDS; i++) {
+    struct mrb_timer_dispatcher *d = dispatchers[i];
+    if (!d || !d->started) {
+      continue;
+    }
+    if (pthread_getcpuclockid(d->thread, &clk) || clock_gettime(clk, &ts) == -1) {
+      continue;
+    }
+    sum += (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+  }
+  pthread_mutex_unlock(&dispatchers_lock);
+  return sum;
+}
+
+#endif
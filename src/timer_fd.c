@@ -0,0 +1,292 @@
+#define _GNU_SOURCE 1
+
+#include <mruby.h>
+#include <mruby/class.h>
+#include <mruby/data.h>
+#include <mruby/error.h>
+#include <mruby/hash.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "timer_thread.h"
+
+#ifdef __linux__
+
+#include <sys/timerfd.h>
+
+/*
+ * Timer::FD wraps timerfd, expirations are read from a file descriptor so
+ * that an event loop (epoll, poll, select...) can watch the timer directly.
+ * No signal and no helper thread is involved.
+ */
+
+typedef struct {
+  int fd;
+  clockid_t clockid;
+  /* aligned schedule of start_every, every_ns is 0 for any other arm */
+  uint64_t every_ns;
+  uint64_t every_offset_ns;
+} mrb_timer_fd_data;
+
+static void mrb_timer_fd_free(mrb_state *mrb, void *p)
+{
+  mrb_timer_fd_data *data = (mrb_timer_fd_data *)p;
+  if (!data) {
+    return;
+  }
+  if (data->fd >= 0) {
+    close(data->fd);
+  }
+  mrb_free(mrb, data);
+}
+
+static const struct mrb_data_type mrb_timer_fd_data_type = {"mrb_timer_fd_data", mrb_timer_fd_free};
+
+static mrb_timer_fd_data *mrb_timer_fd_get(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_fd_data *data = DATA_PTR(self);
+  if (data->fd < 0) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "timerfd already closed");
+  }
+  return data;
+}
+
+/* initialize, accepts clock_id: */
+static mrb_value mrb_timer_fd_init(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_fd_data *data;
+  mrb_value options = mrb_nil_value();
+  mrb_value clock_arg;
+  clockid_t clockid = CLOCK_MONOTONIC;
+  int fd;
+
+  if (mrb_get_args(mrb, "|o", &options) == -1) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot get arguments");
+  }
+
+  if (mrb_hash_p(options)) {
+    clock_arg = mrb_hash_get(mrb, options, mrb_symbol_value(mrb_intern_lit(mrb, "clock_id")));
+    /* has key and is not nil */
+    if (mrb_fixnum_p(clock_arg)) {
+      clockid = (clockid_t)mrb_fixnum(clock_arg);
+    }
+  }
+
+  data = (mrb_timer_fd_data *)DATA_PTR(self);
+  if (data) {
+    mrb_timer_fd_free(mrb, data);
+  }
+  DATA_TYPE(self) = &mrb_timer_fd_data_type;
+  DATA_PTR(self) = NULL;
+
+  fd = timerfd_create(clockid, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (fd == -1) {
+    mrb_sys_fail(mrb, "timerfd_create failed");
+  }
+
+  data = (mrb_timer_fd_data *)mrb_malloc(mrb, sizeof(mrb_timer_fd_data));
+  data->fd = fd;
+  data->clockid = clockid;
+  data->every_ns = 0;
+  data->every_offset_ns = 0;
+
+  DATA_PTR(self) = data;
+  return self;
+}
+
+static mrb_value mrb_timer_fd_start(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_fd_data *data = mrb_timer_fd_get(mrb, self);
+  mrb_int start, interval = 0;
+  struct itimerspec ts;
+
+  /* start and interval should be msec */
+  if (mrb_get_args(mrb, "i|i", &start, &interval) == -1) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot get arguments");
+  }
+  if (start < 0 || interval < 0) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "Values must be 0 or positive");
+  }
+
+  ts.it_value.tv_sec = (time_t)(start / 1000);
+  ts.it_value.tv_nsec = (long)((start % 1000) * 1000000);
+  ts.it_interval.tv_sec = (time_t)(interval / 1000);
+  ts.it_interval.tv_nsec = (long)((interval % 1000) * 1000000);
+
+  if (timerfd_settime(data->fd, 0, &ts, NULL) == -1) {
+    mrb_sys_fail(mrb, "timerfd_settime");
+  }
+  data->every_ns = 0;
+
+  return self;
+}
+
+/*
+ * Arm at the next grid point of the aligned schedule. On CLOCK_REALTIME the
+ * kernel cancels the timer when the clock is set, and the next read re-arms
+ * on the grid of the new time.
+ */
+static int mrb_timer_fd_arm_every(mrb_timer_fd_data *data)
+{
+  struct itimerspec ts;
+  struct timespec now;
+  uint64_t next;
+  int flags = TFD_TIMER_ABSTIME;
+
+  if (clock_gettime(data->clockid, &now) == -1) {
+    return -1;
+  }
+  next = mrb_timer_align_next((uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec, data->every_ns,
+                              data->every_offset_ns);
+  ts.it_value.tv_sec = (time_t)(next / 1000000000ULL);
+  ts.it_value.tv_nsec = (long)(next % 1000000000ULL);
+  ts.it_interval.tv_sec = (time_t)(data->every_ns / 1000000000ULL);
+  ts.it_interval.tv_nsec = (long)(data->every_ns % 1000000000ULL);
+#ifdef TFD_TIMER_CANCEL_ON_SET
+  if (data->clockid == CLOCK_REALTIME) {
+    flags |= TFD_TIMER_CANCEL_ON_SET;
+  }
+#endif
+  return timerfd_settime(data->fd, flags, &ts, NULL);
+}
+
+/* start_every(period_msec, offset_msec = 0), like Timer::POSIX#start_every */
+static mrb_value mrb_timer_fd_start_every(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_fd_data *data = mrb_timer_fd_get(mrb, self);
+  mrb_int period, offset = 0;
+
+  if (mrb_get_args(mrb, "i|i", &period, &offset) == -1) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot get arguments");
+  }
+  if (period <= 0 || offset < 0) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "Period must be positive and offset 0 or positive");
+  }
+
+  data->every_ns = (uint64_t)period * 1000000ULL;
+  data->every_offset_ns = (uint64_t)offset * 1000000ULL;
+  if (mrb_timer_fd_arm_every(data) == -1) {
+    data->every_ns = 0;
+    mrb_sys_fail(mrb, "timerfd_settime");
+  }
+
+  return self;
+}
+
+/* Period of start_every in msec, nil for any other arm */
+static mrb_value mrb_timer_fd_every(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_fd_data *data = mrb_timer_fd_get(mrb, self);
+  if (!data->every_ns) {
+    return mrb_nil_value();
+  }
+  return mrb_fixnum_value((mrb_int)(data->every_ns / 1000000ULL));
+}
+
+static mrb_value mrb_timer_fd_stop(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_fd_data *data = mrb_timer_fd_get(mrb, self);
+  struct itimerspec ts;
+
+  memset(&ts, 0, sizeof(struct itimerspec));
+  if (timerfd_settime(data->fd, 0, &ts, NULL) == -1) {
+    mrb_sys_fail(mrb, "timerfd_settime");
+  }
+  data->every_ns = 0;
+
+  return self;
+}
+
+static mrb_value mrb_timer_fd_is_running(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_fd_data *data = mrb_timer_fd_get(mrb, self);
+  struct itimerspec ts;
+
+  if (timerfd_gettime(data->fd, &ts) == -1) {
+    mrb_sys_fail(mrb, "timerfd_gettime");
+  }
+  return mrb_bool_value(ts.it_value.tv_sec || ts.it_value.tv_nsec);
+}
+
+/*
+ * Number of expirations since the last read, 0 when none (never blocks).
+ * A start_every schedule cancelled by a clock set reads as 0 and is re-armed.
+ */
+static mrb_value mrb_timer_fd_read_expirations(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_fd_data *data = mrb_timer_fd_get(mrb, self);
+  uint64_t count = 0;
+  ssize_t len;
+
+  do {
+    len = read(data->fd, &count, sizeof(uint64_t));
+  } while (len == -1 && errno == EINTR);
+
+  if (len == -1) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return mrb_fixnum_value(0);
+    }
+    if (errno == ECANCELED && data->every_ns) {
+      if (mrb_timer_fd_arm_every(data) == -1) {
+        mrb_sys_fail(mrb, "timerfd_settime");
+      }
+      return mrb_fixnum_value(0);
+    }
+    mrb_sys_fail(mrb, "read timerfd");
+  }
+
+  return mrb_fixnum_value((mrb_int)count);
+}
+
+static mrb_value mrb_timer_fd_fileno(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_fd_data *data = mrb_timer_fd_get(mrb, self);
+  return mrb_fixnum_value(data->fd);
+}
+
+static mrb_value mrb_timer_fd_clockid(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_fd_data *data = DATA_PTR(self);
+  return mrb_fixnum_value((int)data->clockid);
+}
+
+static mrb_value mrb_timer_fd_close(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_fd_data *data = mrb_timer_fd_get(mrb, self);
+
+  close(data->fd);
+  data->fd = -1;
+
+  return mrb_nil_value();
+}
+
+static mrb_value mrb_timer_fd_is_closed(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_fd_data *data = DATA_PTR(self);
+  return mrb_bool_value(data->fd < 0);
+}
+
+void mrb_timer_define_fd(mrb_state *mrb, struct RClass *timer)
+{
+  struct RClass *fd;
+
+  fd = mrb_define_class_under(mrb, timer, "FD", mrb->object_class);
+  MRB_SET_INSTANCE_TT(fd, MRB_TT_DATA);
+  mrb_define_method(mrb, fd, "initialize", mrb_timer_fd_init, MRB_ARGS_ARG(0, 1));
+  mrb_define_method(mrb, fd, "start", mrb_timer_fd_start, MRB_ARGS_ARG(1, 1));
+  mrb_define_method(mrb, fd, "start_every", mrb_timer_fd_start_every, MRB_ARGS_ARG(1, 1));
+  mrb_define_method(mrb, fd, "every", mrb_timer_fd_every, MRB_ARGS_NONE());
+  mrb_define_method(mrb, fd, "stop", mrb_timer_fd_stop, MRB_ARGS_NONE());
+  mrb_define_method(mrb, fd, "running?", mrb_timer_fd_is_running, MRB_ARGS_NONE());
+  mrb_define_method(mrb, fd, "read_expirations", mrb_timer_fd_read_expirations, MRB_ARGS_NONE());
+  mrb_define_method(mrb, fd, "fileno", mrb_timer_fd_fileno, MRB_ARGS_NONE());
+  mrb_define_method(mrb, fd, "clock_id", mrb_timer_fd_clockid, MRB_ARGS_NONE());
+  mrb_define_method(mrb, fd, "close", mrb_timer_fd_close, MRB_ARGS_NONE());
+  mrb_define_method(mrb, fd, "closed?", mrb_timer_fd_is_closed, MRB_ARGS_NONE());
+}
+
+#endif
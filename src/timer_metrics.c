@@ -0,0 +1,92 @@
+#define _GNU_SOURCE 1
+
+#include <mruby.h>
+#include <mruby/hash.h>
+
+#include <stdint.h>
+
+#include "timer_thread.h"
+
+#ifndef __APPLE__
+
+/*
+ * Process wide counters of every backend, bumped with relaxed atomics where
+ * the events happen and read all at once by Timer.metrics. live_* are
+ * gauges, the rest only grow.
+ *
+ * fires and overruns count the expiries the gem sees: those going through a
+ * helper thread, the dispatcher, the wheel or the scheduler, TimerThread,
+ * DeadlineSet#expire and mark_fired. A plain SIGEV_SIGNAL expiry is only
+ * seen by the kernel.
+ */
+
+static int64_t metrics[MRB_TIMER_METRIC_COUNT];
+
+static const char *const metric_names[MRB_TIMER_METRIC_COUNT] = {
+    "live_posix",
+    "live_wheel",
+    "live_scheduler",
+    "live_thread",
+    "live_deadline_sets",
+    "live_deadlines",
+    "live_monotonic",
+    "live_realtime",
+    "live_cputime",
+    "live_other_clock",
+    "live_signal",
+    "live_thread_targeted",
+    "live_queued",
+    "live_no_signal",
+    "arms",
+    "cancels",
+    "fires",
+    "overruns",
+};
+
+void mrb_timer_metric_add(enum mrb_timer_metric metric, int64_t delta)
+{
+  __atomic_add_fetch(&metrics[metric], delta, __ATOMIC_RELAXED);
+}
+
+/*
+ * Timer.metrics(into = nil) => {live_posix: n, ..., dispatcher_cpu_ns: n}
+ *
+ * A flat Hash of Integers. Pass the Hash of the previous call to refill it
+ * in place, a scrape then allocates nothing.
+ */
+static mrb_value mrb_timer_metrics(mrb_state *mrb, mrb_value self)
+{
+  mrb_value into = mrb_nil_value();
+  int i, ai;
+
+  if (mrb_get_args(mrb, "|o", &into) == -1) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot get arguments");
+  }
+  if (!mrb_hash_p(into)) {
+    into = mrb_hash_new_capa(mrb, MRB_TIMER_METRIC_COUNT + 3);
+  }
+
+  ai = mrb_gc_arena_save(mrb);
+  for (i = 0; i < MRB_TIMER_METRIC_COUNT; i++) {
+    mrb_hash_set(mrb, into, mrb_symbol_value(mrb_intern_cstr(mrb, metric_names[i])),
+                 mrb_fixnum_value((mrb_int)__atomic_load_n(&metrics[i], __ATOMIC_RELAXED)));
+  }
+  mrb_hash_set(mrb, into, mrb_symbol_value(mrb_intern_lit(mrb, "event_queue_depth")),
+               mrb_fixnum_value((mrb_int)mrb_timer_ring_depth()));
+  mrb_hash_set(mrb, into, mrb_symbol_value(mrb_intern_lit(mrb, "events_dropped")),
+               mrb_fixnum_value((mrb_int)mrb_timer_ring_dropped()));
+#ifdef MRB_TIMER_HAVE_DISPATCHER
+  mrb_hash_set(mrb, into, mrb_symbol_value(mrb_intern_lit(mrb, "dispatcher_cpu_ns")),
+               mrb_fixnum_value((mrb_int)mrb_timer_dispatcher_cpu_ns()));
+#endif
+  mrb_gc_arena_restore(mrb, ai);
+
+  return into;
+}
+
+void mrb_timer_define_metrics(mrb_state *mrb, struct RClass *timer)
+{
+  mrb_define_module_function(mrb, timer, "metrics", mrb_timer_metrics, MRB_ARGS_OPT(1));
+}
+
+#endif
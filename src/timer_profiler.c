@@ -0,0 +1,339 @@
+#define _GNU_SOURCE 1
+
+#include <mruby.h>
+#include <mruby/class.h>
+#include <mruby/data.h>
+#include <mruby/error.h>
+#include <mruby/hash.h>
+#include <mruby/string.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "timer_thread.h"
+
+#ifdef MRB_TIMER_HAVE_DISPATCHER
+
+/*
+ * Timer::Profiler samples the mruby call stack of the thread that started
+ * it. An interval timer on that thread's CPU time clock sends SIGPROF to the
+ * thread itself (SIGEV_THREAD_ID), and the handler copies the method
+ * symbols of the callinfo chain into a preallocated ring. It runs in the
+ * middle of whatever the VM was doing, so it only reads plain words and never
+ * follows a pointer out of the callinfo array: no proc, no irep, no debug info
+ * (so no file and line). The array is bounds checked once against cibase and
+ * ciend, and a tick is skipped while ci sits on the last slot, the only state
+ * in which cipush can be reallocating it. report aggregates the samples into
+ * folded stacks with SIGPROF blocked.
+ *
+ * The innermost method can be that of a frame cipush has not filled in yet.
+ */
+
+#define PROFILER_MAX_DEPTH 32
+
+struct mrb_timer_profiler_sample {
+  uint32_t depth;
+  mrb_sym mids[PROFILER_MAX_DEPTH]; /* innermost first */
+};
+
+typedef struct {
+  mrb_state *mrb;
+  struct mrb_timer_profiler_sample *ring;
+  uint64_t size;
+  uint64_t head; /* written by the handler */
+  uint64_t tail; /* written by report */
+  uint64_t dropped; /* ring full */
+  uint64_t skipped; /* callinfo array in flux */
+  uint64_t interval_ns;
+  clockid_t clockid;
+  int has_clock;
+  int running;
+  timer_t timer;
+  struct sigaction old_action;
+} mrb_timer_profiler_data;
+
+/* SIGPROF is process wide, one profiler runs at a time */
+static mrb_timer_profiler_data *profiler_active = NULL;
+
+/* signal context: no allocation, no lock, nothing but the callinfo words; 0 when the tick is skipped */
+static int profiler_sample(mrb_timer_profiler_data *p, struct mrb_timer_profiler_sample *s)
+{
+  struct mrb_context *c = p->mrb->c;
+  mrb_callinfo *ci, *base, *end;
+
+  s->depth = 0;
+  if (!c) {
+    return 0;
+  }
+  ci = c->ci;
+  base = c->cibase;
+  end = c->ciend;
+  if (!ci || !base || ci < base || ci + 1 >= end) {
+    return 0;
+  }
+  for (; ci >= base && s->depth < PROFILER_MAX_DEPTH; ci--) {
+    s->mids[s->depth++] = ci->mid;
+  }
+  return 1;
+}
+
+static void profiler_handler(int signo, siginfo_t *info, void *uc)
+{
+  mrb_timer_profiler_data *p = __atomic_load_n(&profiler_active, __ATOMIC_ACQUIRE);
+  uint64_t head, tail;
+  int saved_errno;
+
+  if (!p || info->si_code != SI_TIMER) {
+    return;
+  }
+  saved_errno = errno;
+  head = __atomic_load_n(&p->head, __ATOMIC_RELAXED);
+  tail = __atomic_load_n(&p->tail, __ATOMIC_ACQUIRE);
+  if (head - tail >= p->size) {
+    __atomic_add_fetch(&p->dropped, 1, __ATOMIC_RELAXED);
+  } else if (profiler_sample(p, &p->ring[head % p->size])) {
+    __atomic_store_n(&p->head, head + 1, __ATOMIC_RELEASE);
+  } else {
+    __atomic_add_fetch(&p->skipped, 1, __ATOMIC_RELAXED);
+  }
+  errno = saved_errno;
+}
+
+static void profiler_stop(mrb_timer_profiler_data *p)
+{
+  if (!p->running) {
+    return;
+  }
+  /* timer_delete also drops a SIGPROF still pending, the old action is safe to restore */
+  timer_delete(p->timer);
+  __atomic_store_n(&profiler_active, NULL, __ATOMIC_RELEASE);
+  sigaction(SIGPROF, &p->old_action, NULL);
+  p->running = 0;
+}
+
+static void mrb_timer_profiler_free(mrb_state *mrb, void *ptr)
+{
+  mrb_timer_profiler_data *p = (mrb_timer_profiler_data *)ptr;
+  if (!p) {
+    return;
+  }
+  profiler_stop(p);
+  mrb_free(mrb, p->ring);
+  mrb_free(mrb, p);
+}
+
+static const struct mrb_data_type mrb_timer_profiler_data_type = {"mrb_timer_profiler_data",
+                                                                  mrb_timer_profiler_free};
+
+/* initialize(interval_usec: 1000, size: 4096, clock_id: thread CPU time) */
+static mrb_value mrb_timer_profiler_init(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_profiler_data *p;
+  mrb_value options = mrb_nil_value(), v;
+  mrb_int interval_usec = 1000, size = 4096;
+
+  if (mrb_get_args(mrb, "|o", &options) == -1) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot get arguments");
+  }
+
+  p = (mrb_timer_profiler_data *)DATA_PTR(self);
+  if (p) {
+    mrb_timer_profiler_free(mrb, p);
+  }
+  DATA_TYPE(self) = &mrb_timer_profiler_data_type;
+  DATA_PTR(self) = NULL;
+
+  p = (mrb_timer_profiler_data *)mrb_malloc(mrb, sizeof(mrb_timer_profiler_data));
+  memset(p, 0, sizeof(mrb_timer_profiler_data));
+  DATA_PTR(self) = p;
+
+  if (mrb_hash_p(options)) {
+    v = mrb_hash_get(mrb, options, mrb_symbol_value(mrb_intern_lit(mrb, "interval_usec")));
+    if (mrb_fixnum_p(v)) {
+      interval_usec = mrb_fixnum(v);
+    }
+    v = mrb_hash_get(mrb, options, mrb_symbol_value(mrb_intern_lit(mrb, "size")));
+    if (mrb_fixnum_p(v)) {
+      size = mrb_fixnum(v);
+    }
+    v = mrb_hash_get(mrb, options, mrb_symbol_value(mrb_intern_lit(mrb, "clock_id")));
+    if (mrb_fixnum_p(v)) {
+      p->clockid = (clockid_t)mrb_fixnum(v);
+      p->has_clock = 1;
+    }
+  }
+  if (interval_usec <= 0 || size <= 0) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "interval_usec and size must be positive");
+  }
+
+  p->mrb = mrb;
+  p->interval_ns = (uint64_t)interval_usec * 1000ULL;
+  p->size = (uint64_t)size;
+  p->ring = (struct mrb_timer_profiler_sample *)mrb_malloc(mrb, sizeof(struct mrb_timer_profiler_sample) * size);
+
+  return self;
+}
+
+static mrb_value mrb_timer_profiler_start(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_profiler_data *p = DATA_PTR(self);
+  mrb_timer_profiler_data *expected = NULL;
+  struct sigaction sa;
+  struct sigevent sev;
+  struct itimerspec ts;
+  clockid_t clockid = p->clockid;
+  int err;
+
+  if (p->running) {
+    return self;
+  }
+  if (!p->has_clock && (err = pthread_getcpuclockid(pthread_self(), &clockid))) {
+    errno = err;
+    mrb_sys_fail(mrb, "pthread_getcpuclockid");
+  }
+
+  memset(&sev, 0, sizeof(struct sigevent));
+  sev.sigev_notify = SIGEV_THREAD_ID;
+  sev.sigev_notify_thread_id = (pid_t)syscall(SYS_gettid);
+  sev.sigev_signo = SIGPROF;
+  if (timer_create(clockid, &sev, &p->timer) == -1) {
+    mrb_sys_fail(mrb, "timer_create failed");
+  }
+
+  if (!__atomic_compare_exchange_n(&profiler_active, &expected, p, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    timer_delete(p->timer);
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Another Timer::Profiler is running");
+  }
+
+  memset(&sa, 0, sizeof(struct sigaction));
+  sa.sa_sigaction = profiler_handler;
+  sa.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGPROF, &sa, &p->old_action);
+  p->running = 1;
+
+  ts.it_value.tv_sec = (time_t)(p->interval_ns / 1000000000ULL);
+  ts.it_value.tv_nsec = (long)(p->interval_ns % 1000000000ULL);
+  ts.it_interval = ts.it_value;
+  if (timer_settime(p->timer, 0, &ts, NULL) == -1) {
+    err = errno;
+    profiler_stop(p);
+    errno = err;
+    mrb_sys_fail(mrb, "timer_settime");
+  }
+
+  return self;
+}
+
+static mrb_value mrb_timer_profiler_stop(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_profiler_data *p = DATA_PTR(self);
+  profiler_stop(p);
+  return self;
+}
+
+static mrb_value mrb_timer_profiler_is_running(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_profiler_data *p = DATA_PTR(self);
+  return mrb_bool_value(p->running);
+}
+
+/* Samples waiting for report */
+static mrb_value mrb_timer_profiler_samples(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_profiler_data *p = DATA_PTR(self);
+  return mrb_fixnum_value(
+      (mrb_int)(__atomic_load_n(&p->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&p->tail, __ATOMIC_RELAXED)));
+}
+
+/* Ticks lost because the ring was full */
+static mrb_value mrb_timer_profiler_dropped(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_profiler_data *p = DATA_PTR(self);
+  return mrb_fixnum_value((mrb_int)__atomic_load_n(&p->dropped, __ATOMIC_RELAXED));
+}
+
+/* Ticks lost because the callinfo array was being grown */
+static mrb_value mrb_timer_profiler_skipped(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_profiler_data *p = DATA_PTR(self);
+  return mrb_fixnum_value((mrb_int)__atomic_load_n(&p->skipped, __ATOMIC_RELAXED));
+}
+
+static void profiler_cat_frame(mrb_state *mrb, mrb_value str, mrb_sym mid)
+{
+  const char *name;
+
+  if (!mid) {
+    mrb_str_cat_lit(mrb, str, "<main>");
+  } else if ((name = mrb_sym2name(mrb, mid)) != NULL) {
+    mrb_str_cat_cstr(mrb, str, name);
+  } else {
+    /* a stale word of a frame not filled in yet */
+    mrb_str_cat_lit(mrb, str, "?");
+  }
+}
+
+/* report => {"outer;inner" => count, ...} of the samples taken since the last report */
+static mrb_value mrb_timer_profiler_report(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_profiler_data *p = DATA_PTR(self);
+  struct mrb_timer_profiler_sample *s;
+  sigset_t set, old;
+  mrb_value ret, key;
+  uint64_t head, tail;
+  uint32_t i;
+  int ai;
+
+  /* the handler only runs on the profiled thread, blocking it there is enough */
+  sigemptyset(&set);
+  sigaddset(&set, SIGPROF);
+  pthread_sigmask(SIG_BLOCK, &set, &old);
+
+  ret = mrb_hash_new(mrb);
+  head = __atomic_load_n(&p->head, __ATOMIC_ACQUIRE);
+  ai = mrb_gc_arena_save(mrb);
+  for (tail = p->tail; tail != head; tail++) {
+    s = &p->ring[tail % p->size];
+    key = mrb_str_new_capa(mrb, 64);
+    for (i = s->depth; i > 0; i--) {
+      profiler_cat_frame(mrb, key, s->mids[i - 1]);
+      if (i > 1) {
+        mrb_str_cat_lit(mrb, key, ";");
+      }
+    }
+    mrb_hash_set(mrb, ret, key,
+                 mrb_fixnum_value(mrb_fixnum(mrb_hash_fetch(mrb, ret, key, mrb_fixnum_value(0))) + 1));
+    mrb_gc_arena_restore(mrb, ai);
+  }
+  __atomic_store_n(&p->tail, head, __ATOMIC_RELEASE);
+
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  return ret;
+}
+
+void mrb_timer_define_profiler(mrb_state *mrb, struct RClass *timer)
+{
+  struct RClass *prof;
+
+  prof = mrb_define_class_under(mrb, timer, "Profiler", mrb->object_class);
+  MRB_SET_INSTANCE_TT(prof, MRB_TT_DATA);
+  mrb_define_method(mrb, prof, "initialize", mrb_timer_profiler_init, MRB_ARGS_ARG(0, 1));
+  mrb_define_method(mrb, prof, "start", mrb_timer_profiler_start, MRB_ARGS_NONE());
+  mrb_define_method(mrb, prof, "stop", mrb_timer_profiler_stop, MRB_ARGS_NONE());
+  mrb_define_method(mrb, prof, "running?", mrb_timer_profiler_is_running, MRB_ARGS_NONE());
+  mrb_define_method(mrb, prof, "samples", mrb_timer_profiler_samples, MRB_ARGS_NONE());
+  mrb_define_method(mrb, prof, "dropped", mrb_timer_profiler_dropped, MRB_ARGS_NONE());
+  mrb_define_method(mrb, prof, "skipped", mrb_timer_profiler_skipped, MRB_ARGS_NONE());
+  mrb_define_method(mrb, prof, "report", mrb_timer_profiler_report, MRB_ARGS_NONE());
+  mrb_define_const(mrb, prof, "MAX_DEPTH", mrb_fixnum_value(PROFILER_MAX_DEPTH));
+}
+
+#endif
@@ -0,0 +1,157 @@
+#define _GNU_SOURCE 1
+
+#include <mruby.h>
+#include <mruby/array.h>
+
+#include <stdint.h>
+#include <time.h>
+
+#include "timer_thread.h"
+
+#ifndef __APPLE__
+
+/*
+ * Process wide expiry queue for timers created with queue: true.
+ *
+ * A bounded lock-free ring (Vyukov's sequence numbered cells): the
+ * dispatcher thread and the wheel push one event per expiry, mruby threads
+ * drain them in batches with Timer.drain_events. No signal reaches mruby.
+ */
+
+#define RING_SIZE 4096
+#define RING_MASK (RING_SIZE - 1)
+
+struct mrb_timer_ring_cell {
+  /* sequence minus the cell index, so that a zeroed cell is ready for its first lap */
+  uint64_t seq;
+  struct mrb_timer_event ev;
+};
+
+static struct mrb_timer_ring_cell ring[RING_SIZE];
+static uint64_t ring_enqueue = 0;
+static uint64_t ring_dequeue = 0;
+static uint64_t ring_dropped = 0;
+static uint32_t timer_last_id = 0;
+
+uint32_t mrb_timer_next_id(void)
+{
+  return __atomic_add_fetch(&timer_last_id, 1, __ATOMIC_RELAXED);
+}
+
+int mrb_timer_ring_push(uint32_t id, uint32_t count)
+{
+  struct mrb_timer_ring_cell *cell;
+  struct timespec ts;
+  uint64_t pos, seq, idx;
+  int64_t diff;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  pos = __atomic_load_n(&ring_enqueue, __ATOMIC_RELAXED);
+  for (;;) {
+    idx = pos & RING_MASK;
+    cell = &ring[idx];
+    seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) + idx;
+    diff = (int64_t)(seq - pos);
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&ring_enqueue, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        break;
+      }
+    } else if (diff < 0) {
+      /* full */
+      __atomic_add_fetch(&ring_dropped, 1, __ATOMIC_RELAXED);
+      return -1;
+    } else {
+      pos = __atomic_load_n(&ring_enqueue, __ATOMIC_RELAXED);
+    }
+  }
+
+  cell->ev.id = id;
+  cell->ev.count = count;
+  cell->ev.ts_ns = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+  __atomic_store_n(&cell->seq, pos + 1 - idx, __ATOMIC_RELEASE);
+  return 0;
+}
+
+int mrb_timer_ring_pop(struct mrb_timer_event *ev)
+{
+  struct mrb_timer_ring_cell *cell;
+  uint64_t pos, seq, idx;
+  int64_t diff;
+
+  pos = __atomic_load_n(&ring_dequeue, __ATOMIC_RELAXED);
+  for (;;) {
+    idx = pos & RING_MASK;
+    cell = &ring[idx];
+    seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) + idx;
+    diff = (int64_t)(seq - (pos + 1));
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&ring_dequeue, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        break;
+      }
+    } else if (diff < 0) {
+      /* empty */
+      return -1;
+    } else {
+      pos = __atomic_load_n(&ring_dequeue, __ATOMIC_RELAXED);
+    }
+  }
+
+  *ev = cell->ev;
+  __atomic_store_n(&cell->seq, pos + RING_SIZE - idx, __ATOMIC_RELEASE);
+  return 0;
+}
+
+/* Events pushed and not popped yet, a racy snapshot */
+uint64_t mrb_timer_ring_depth(void)
+{
+  uint64_t dequeue = __atomic_load_n(&ring_dequeue, __ATOMIC_RELAXED);
+  uint64_t enqueue = __atomic_load_n(&ring_enqueue, __ATOMIC_RELAXED);
+
+  return enqueue > dequeue ? enqueue - dequeue : 0;
+}
+
+uint64_t mrb_timer_ring_dropped(void)
+{
+  return __atomic_load_n(&ring_dropped, __ATOMIC_RELAXED);
+}
+
+/* Timer.drain_events(max = nil) => [[timer_id, expirations, monotonic_nsec], ...] */
+static mrb_value mrb_timer_drain_events(mrb_state *mrb, mrb_value self)
+{
+  mrb_int max = RING_SIZE, n;
+  mrb_value ret, ev[3];
+  struct mrb_timer_event e;
+  int ai;
+
+  if (mrb_get_args(mrb, "|i", &max) == -1) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot get arguments");
+  }
+
+  ret = mrb_ary_new(mrb);
+  ai = mrb_gc_arena_save(mrb);
+  for (n = 0; n < max && mrb_timer_ring_pop(&e) == 0; n++) {
+    ev[0] = mrb_fixnum_value((mrb_int)e.id);
+    ev[1] = mrb_fixnum_value((mrb_int)e.count);
+    ev[2] = mrb_fixnum_value((mrb_int)e.ts_ns);
+    mrb_ary_push(mrb, ret, mrb_ary_new_from_values(mrb, 3, ev));
+    mrb_gc_arena_restore(mrb, ai);
+  }
+
+  return ret;
+}
+
+/* Events lost because the ring was full */
+static mrb_value mrb_timer_dropped_events(mrb_state *mrb, mrb_value self)
+{
+  return mrb_fixnum_value((mrb_int)mrb_timer_ring_dropped());
+}
+
+void mrb_timer_define_ring(mrb_state *mrb, struct RClass *timer)
+{
+  mrb_define_module_function(mrb, timer, "drain_events", mrb_timer_drain_events, MRB_ARGS_OPT(1));
+  mrb_define_module_function(mrb, timer, "dropped_events", mrb_timer_dropped_events, MRB_ARGS_NONE());
+  mrb_define_const(mrb, timer, "EVENT_QUEUE_SIZE", mrb_fixnum_value(RING_SIZE));
+}
+
+#endif
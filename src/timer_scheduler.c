@@ -0,0 +1,569 @@
+#define _GNU_SOURCE 1
+
+#include <mruby.h>
+#include <mruby/class.h>
+#include <mruby/data.h>
+#include <mruby/error.h>
+#include <mruby/hash.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "timer_thread.h"
+
+#ifndef __APPLE__
+
+/*
+ * Timer::Scheduler has the interface of Timer::MRubyThread, but every
+ * timer of the process shares one C thread: it keeps the pending deadlines
+ * in a 4-ary min-heap, sleeps in pthread_cond_timedwait on CLOCK_MONOTONIC
+ * until the earliest one, then signals its target and wakes its joiners.
+ * With shard: n the timer goes to a scheduler thread pinned to CPU n.
+ *
+ * One lock per scheduler covers its heap and entries. An entry is
+ * referenced by its Ruby object and by the heap while pending, so a
+ * fire-and-forget run_with_signal still fires after GC.
+ *
+ * stop tombstones the entry in O(1) and leaves it in the heap; the thread
+ * drops tombstones when they reach the front, and stop compacts the heap
+ * once they outnumber the live entries. A run on a tombstoned entry just
+ * revives it at its new deadline.
+ */
+
+#define SCHED_ARITY 4
+#define SCHED_NOT_QUEUED SIZE_MAX
+#define SCHED_COMPACT_MIN 64
+
+struct mrb_timer_sched;
+
+struct mrb_timer_sched_entry {
+  struct mrb_timer_sched *owner;
+  uint64_t deadline_ns;
+  size_t index; /* position in the heap, SCHED_NOT_QUEUED while idle */
+  int dead;     /* stopped, still in the heap */
+  int refs;
+  int signo; /* 0 sends no signal */
+  int has_thread;
+  pthread_t thread_id;
+};
+
+struct mrb_timer_sched {
+  pthread_mutex_t lock;
+  pthread_cond_t wake;  /* the scheduler thread waits on it */
+  pthread_cond_t fired; /* wait and blocking_handler wait on it */
+  struct mrb_timer_sched_entry **heap;
+  size_t len;
+  size_t capa;
+  size_t dead; /* tombstones in the heap */
+  int err;
+  int shard; /* -1 for the unpinned default */
+};
+
+/* index 0 is the default, shard n is at n + 1 */
+static struct mrb_timer_sched *scheds[MRB_TIMER_MAX_SHARDS + 1];
+static pthread_mutex_t scheds_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t sched_clock_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void sched_set(struct mrb_timer_sched *s, size_t i, struct mrb_timer_sched_entry *e)
+{
+  s->heap[i] = e;
+  e->index = i;
+}
+
+static void sched_sift_up(struct mrb_timer_sched *s, size_t i)
+{
+  struct mrb_timer_sched_entry *e = s->heap[i];
+  size_t parent;
+
+  while (i > 0) {
+    parent = (i - 1) / SCHED_ARITY;
+    if (s->heap[parent]->deadline_ns <= e->deadline_ns) {
+      break;
+    }
+    sched_set(s, i, s->heap[parent]);
+    i = parent;
+  }
+  sched_set(s, i, e);
+}
+
+static void sched_sift_down(struct mrb_timer_sched *s, size_t i)
+{
+  struct mrb_timer_sched_entry *e = s->heap[i];
+  size_t child, first, last, min;
+
+  for (;;) {
+    first = i * SCHED_ARITY + 1;
+    if (first >= s->len) {
+      break;
+    }
+    last = first + SCHED_ARITY < s->len ? first + SCHED_ARITY : s->len;
+    min = first;
+    for (child = first + 1; child < last; child++) {
+      if (s->heap[child]->deadline_ns < s->heap[min]->deadline_ns) {
+        min = child;
+      }
+    }
+    if (s->heap[min]->deadline_ns >= e->deadline_ns) {
+      break;
+    }
+    sched_set(s, i, s->heap[min]);
+    i = min;
+  }
+  sched_set(s, i, e);
+}
+
+static void sched_remove(struct mrb_timer_sched_entry *e)
+{
+  struct mrb_timer_sched *s = e->owner;
+  size_t i = e->index;
+  struct mrb_timer_sched_entry *last = s->heap[--s->len];
+
+  e->index = SCHED_NOT_QUEUED;
+  if (last == e) {
+    return;
+  }
+  sched_set(s, i, last);
+  sched_sift_down(s, i);
+  sched_sift_up(s, last->index);
+}
+
+static void sched_unref(struct mrb_timer_sched_entry *e)
+{
+  if (--e->refs == 0) {
+    free(e);
+  }
+}
+
+/* pending and not stopped */
+static int sched_pending(struct mrb_timer_sched_entry *e)
+{
+  return e->index != SCHED_NOT_QUEUED && !e->dead;
+}
+
+/* Take a tombstone out of the heap for good */
+static void sched_drop(struct mrb_timer_sched *s, struct mrb_timer_sched_entry *e)
+{
+  sched_remove(e);
+  e->dead = 0;
+  s->dead--;
+  sched_unref(e);
+}
+
+/* Drop every tombstone and heapify the rest, O(n) */
+static void sched_compact(struct mrb_timer_sched *s)
+{
+  struct mrb_timer_sched_entry *e;
+  size_t i, n = 0;
+
+  for (i = 0; i < s->len; i++) {
+    e = s->heap[i];
+    if (e->dead) {
+      e->index = SCHED_NOT_QUEUED;
+      e->dead = 0;
+      sched_unref(e);
+    } else {
+      sched_set(s, n++, e);
+    }
+  }
+  s->len = n;
+  s->dead = 0;
+  for (i = n / SCHED_ARITY + 1; i-- > 0;) {
+    if (i < n) {
+      sched_sift_down(s, i);
+    }
+  }
+}
+
+static void sched_notify(struct mrb_timer_sched_entry *e)
+{
+  if (e->signo <= 0) {
+    return;
+  }
+  if (e->has_thread) {
+    pthread_kill(e->thread_id, e->signo);
+  } else {
+    kill(getpid(), e->signo);
+  }
+}
+
+static void *sched_func(void *arg)
+{
+  struct mrb_timer_sched *s = (struct mrb_timer_sched *)arg;
+  struct mrb_timer_sched_entry *e;
+  struct timespec ts;
+  uint64_t now;
+  int fired;
+
+  pthread_mutex_lock(&s->lock);
+  for (;;) {
+    while (s->len && s->heap[0]->dead) {
+      sched_drop(s, s->heap[0]);
+    }
+    if (!s->len) {
+      pthread_cond_wait(&s->wake, &s->lock);
+      continue;
+    }
+
+    now = sched_clock_ns();
+    fired = 0;
+    while (s->len && s->heap[0]->deadline_ns <= now) {
+      e = s->heap[0];
+      if (e->dead) {
+        sched_drop(s, e);
+        continue;
+      }
+      sched_remove(e);
+      sched_notify(e);
+      sched_unref(e);
+      mrb_timer_metric_add(MRB_TIMER_METRIC_FIRES, 1);
+      fired = 1;
+    }
+    if (fired) {
+      pthread_cond_broadcast(&s->fired);
+      continue;
+    }
+    if (!s->len) {
+      continue;
+    }
+
+    ts.tv_sec = (time_t)(s->heap[0]->deadline_ns / 1000000000ULL);
+    ts.tv_nsec = (long)(s->heap[0]->deadline_ns % 1000000000ULL);
+    pthread_cond_timedwait(&s->wake, &s->lock, &ts);
+  }
+  return NULL;
+}
+
+/* The scheduler of a shard, started on first use; NULL with errno on failure */
+static struct mrb_timer_sched *sched_get(int shard)
+{
+  struct mrb_timer_sched *s;
+  pthread_condattr_t attr;
+  pthread_attr_t tattr;
+  pthread_t th;
+  sigset_t all, old;
+
+  pthread_mutex_lock(&scheds_lock);
+  s = scheds[shard + 1];
+  if (s) {
+    pthread_mutex_unlock(&scheds_lock);
+    return s;
+  }
+  s = (struct mrb_timer_sched *)calloc(1, sizeof(struct mrb_timer_sched));
+  if (!s) {
+    pthread_mutex_unlock(&scheds_lock);
+    errno = ENOMEM;
+    return NULL;
+  }
+  pthread_mutex_init(&s->lock, NULL);
+  s->shard = shard;
+
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&s->wake, &attr);
+  pthread_cond_init(&s->fired, &attr);
+  pthread_condattr_destroy(&attr);
+
+  /* the scheduler takes no signal */
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  pthread_attr_init(&tattr);
+  pthread_attr_setdetachstate(&tattr, PTHREAD_CREATE_DETACHED);
+  mrb_timer_shard_attr(&tattr, shard);
+  s->err = pthread_create(&th, &tattr, sched_func, s);
+  pthread_attr_destroy(&tattr);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+  if (s->err) {
+    errno = s->err;
+    pthread_cond_destroy(&s->wake);
+    pthread_cond_destroy(&s->fired);
+    pthread_mutex_destroy(&s->lock);
+    free(s);
+    s = NULL;
+  } else {
+    scheds[shard + 1] = s;
+  }
+  pthread_mutex_unlock(&scheds_lock);
+  return s;
+}
+
+typedef struct {
+  struct mrb_timer_sched_entry *entry;
+  mrb_int retry_timer_usec;
+} mrb_timer_sched_data;
+
+static void mrb_timer_sched_free(mrb_state *mrb, void *p)
+{
+  mrb_timer_sched_data *data = (mrb_timer_sched_data *)p;
+  struct mrb_timer_sched *s;
+  if (!data) {
+    return;
+  }
+  /* a pending timer still fires, the heap holds its own reference */
+  s = data->entry->owner;
+  pthread_mutex_lock(&s->lock);
+  sched_unref(data->entry);
+  pthread_mutex_unlock(&s->lock);
+  mrb_free(mrb, data);
+  mrb_timer_metric_add(MRB_TIMER_METRIC_LIVE_SCHEDULER, -1);
+}
+
+static const struct mrb_data_type mrb_timer_sched_data_type = {"mrb_timer_sched_data", mrb_timer_sched_free};
+
+/*
+ * initialize(retry_timer_usec = 1000, shard: nil), retry_timer_usec is
+ * accepted like Timer::MRubyThread but nothing polls
+ */
+static mrb_value mrb_timer_sched_init(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_sched_data *data;
+  struct mrb_timer_sched_entry *e;
+  struct mrb_timer_sched *s;
+  mrb_value arg1 = mrb_nil_value(), arg2 = mrb_nil_value(), options = mrb_nil_value();
+  mrb_int retry_timer_usec = 1000;
+  int shard = -1;
+
+  if (mrb_get_args(mrb, "|oo", &arg1, &arg2) == -1) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot get arguments");
+  }
+  if (mrb_hash_p(arg1)) {
+    options = arg1;
+  } else {
+    if (!mrb_nil_p(arg1)) {
+      retry_timer_usec = mrb_fixnum(mrb_to_int(mrb, arg1));
+    }
+    options = arg2;
+  }
+  if (mrb_hash_p(options)) {
+    shard = mrb_timer_shard_arg(mrb, mrb_hash_get(mrb, options, mrb_symbol_value(mrb_intern_lit(mrb, "shard"))));
+  }
+
+  s = sched_get(shard);
+  if (!s) {
+    mrb_sys_fail(mrb, "scheduler thread");
+  }
+
+  data = (mrb_timer_sched_data *)DATA_PTR(self);
+  if (data) {
+    mrb_timer_sched_free(mrb, data);
+  }
+  DATA_TYPE(self) = &mrb_timer_sched_data_type;
+  DATA_PTR(self) = NULL;
+
+  e = (struct mrb_timer_sched_entry *)calloc(1, sizeof(struct mrb_timer_sched_entry));
+  if (!e) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot allocate scheduler entry");
+  }
+  e->owner = s;
+  e->index = SCHED_NOT_QUEUED;
+  e->refs = 1;
+
+  data = (mrb_timer_sched_data *)mrb_malloc(mrb, sizeof(mrb_timer_sched_data));
+  data->entry = e;
+  data->retry_timer_usec = retry_timer_usec;
+  mrb_timer_metric_add(MRB_TIMER_METRIC_LIVE_SCHEDULER, 1);
+  DATA_PTR(self) = data;
+  return self;
+}
+
+/* (Re)schedule the entry msec from now, a pending deadline is replaced */
+static void mrb_timer_sched_arm(mrb_state *mrb, mrb_value self, mrb_int msec, int signo, int has_thread,
+                                pthread_t thread_id)
+{
+  mrb_timer_sched_data *data = DATA_PTR(self);
+  struct mrb_timer_sched_entry *e = data->entry;
+  struct mrb_timer_sched *s = e->owner;
+
+  if (msec < 0) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "Values must be 0 or positive");
+  }
+
+  pthread_mutex_lock(&s->lock);
+  if (e->index == SCHED_NOT_QUEUED && s->len == s->capa) {
+    size_t capa = s->capa ? s->capa * 2 : 64;
+    struct mrb_timer_sched_entry **heap = realloc(s->heap, sizeof(*heap) * capa);
+    if (!heap) {
+      pthread_mutex_unlock(&s->lock);
+      mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot allocate scheduler heap");
+    }
+    s->heap = heap;
+    s->capa = capa;
+  }
+
+  e->signo = signo;
+  e->has_thread = has_thread;
+  e->thread_id = thread_id;
+  e->deadline_ns = sched_clock_ns() + (uint64_t)msec * 1000000ULL;
+  if (e->index == SCHED_NOT_QUEUED) {
+    e->refs++;
+    sched_set(s, s->len++, e);
+    sched_sift_up(s, e->index);
+  } else {
+    if (e->dead) {
+      e->dead = 0;
+      s->dead--;
+    }
+    sched_sift_down(s, e->index);
+    sched_sift_up(s, e->index);
+  }
+  /* only a new earliest deadline needs the scheduler to look again */
+  if (e->index == 0) {
+    pthread_cond_signal(&s->wake);
+  }
+  pthread_mutex_unlock(&s->lock);
+  mrb_timer_metric_add(MRB_TIMER_METRIC_ARMS, 1);
+}
+
+static mrb_value mrb_timer_sched_run(mrb_state *mrb, mrb_value self)
+{
+  mrb_int msec;
+
+  if (mrb_get_args(mrb, "i", &msec) == -1) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot get arguments");
+  }
+  mrb_timer_sched_arm(mrb, self, msec, 0, 0, 0);
+
+  return self;
+}
+
+/* thread_id is a SignalThread#thread_id, the whole process is signalled without it */
+static mrb_value mrb_timer_sched_run_with_signal(mrb_state *mrb, mrb_value self)
+{
+  mrb_int msec;
+  mrb_value signal, thread_id_arg = mrb_nil_value();
+  pthread_t thread_id = 0;
+  int signo, has_thread = 0;
+
+  if (mrb_get_args(mrb, "io|o", &msec, &signal, &thread_id_arg) == -1) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot get arguments");
+  }
+
+  signo = mrb_timer_to_signo(mrb, signal);
+  if (signo <= 0) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "Invalid value for signal");
+  }
+  if (mrb_float_p(thread_id_arg)) {
+    thread_id = (pthread_t)mrb_float(thread_id_arg);
+    has_thread = 1;
+  } else if (mrb_fixnum_p(thread_id_arg)) {
+    thread_id = (pthread_t)mrb_fixnum(thread_id_arg);
+    has_thread = 1;
+  }
+  mrb_timer_sched_arm(mrb, self, msec, signo, has_thread, thread_id);
+
+  return self;
+}
+
+/* Cancel a pending timer, its joiners are woken up */
+static mrb_value mrb_timer_sched_stop(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_sched_data *data = DATA_PTR(self);
+  struct mrb_timer_sched_entry *e = data->entry;
+  struct mrb_timer_sched *s = e->owner;
+
+  pthread_mutex_lock(&s->lock);
+  if (sched_pending(e)) {
+    e->dead = 1;
+    s->dead++;
+    if (s->dead >= SCHED_COMPACT_MIN && s->dead > s->len / 2) {
+      sched_compact(s);
+    }
+    pthread_cond_broadcast(&s->fired);
+    mrb_timer_metric_add(MRB_TIMER_METRIC_CANCELS, 1);
+  }
+  pthread_mutex_unlock(&s->lock);
+
+  return self;
+}
+
+static mrb_value mrb_timer_sched_is_running(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_sched_data *data = DATA_PTR(self);
+  struct mrb_timer_sched *s = data->entry->owner;
+  mrb_bool running;
+
+  pthread_mutex_lock(&s->lock);
+  running = sched_pending(data->entry);
+  pthread_mutex_unlock(&s->lock);
+
+  return mrb_bool_value(running);
+}
+
+/* Block until the pending timer has fired (or was stopped) */
+static mrb_value mrb_timer_sched_wait(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_sched_data *data = DATA_PTR(self);
+  struct mrb_timer_sched *s = data->entry->owner;
+
+  pthread_mutex_lock(&s->lock);
+  while (sched_pending(data->entry)) {
+    pthread_cond_wait(&s->fired, &s->lock);
+  }
+  pthread_mutex_unlock(&s->lock);
+
+  return self;
+}
+
+static mrb_value mrb_timer_sched_retry_timer_usec(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_sched_data *data = DATA_PTR(self);
+  return mrb_fixnum_value(data->retry_timer_usec);
+}
+
+/* Timers waiting in the heaps of every shard */
+static mrb_value mrb_timer_sched_pending(mrb_state *mrb, mrb_value self)
+{
+  struct mrb_timer_sched *s;
+  size_t len = 0;
+  int i;
+
+  pthread_mutex_lock(&scheds_lock);
+  for (i = 0; i <= MRB_TIMER_MAX_SHARDS; i++) {
+    if ((s = scheds[i])) {
+      pthread_mutex_lock(&s->lock);
+      len += s->len - s->dead;
+      pthread_mutex_unlock(&s->lock);
+    }
+  }
+  pthread_mutex_unlock(&scheds_lock);
+
+  return mrb_fixnum_value((mrb_int)len);
+}
+
+/* Scheduler shard of the timer, nil for the default one */
+static mrb_value mrb_timer_sched_shard(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_sched_data *data = DATA_PTR(self);
+  return data->entry->owner->shard >= 0 ? mrb_fixnum_value(data->entry->owner->shard) : mrb_nil_value();
+}
+
+void mrb_timer_define_scheduler(mrb_state *mrb, struct RClass *timer)
+{
+  struct RClass *s;
+
+  s = mrb_define_class_under(mrb, timer, "Scheduler", mrb->object_class);
+  MRB_SET_INSTANCE_TT(s, MRB_TT_DATA);
+  mrb_define_method(mrb, s, "initialize", mrb_timer_sched_init, MRB_ARGS_OPT(2));
+  mrb_define_method(mrb, s, "run", mrb_timer_sched_run, MRB_ARGS_REQ(1));
+  mrb_define_method(mrb, s, "run_with_signal", mrb_timer_sched_run_with_signal, MRB_ARGS_ARG(2, 1));
+  mrb_define_method(mrb, s, "stop", mrb_timer_sched_stop, MRB_ARGS_NONE());
+  mrb_define_method(mrb, s, "running?", mrb_timer_sched_is_running, MRB_ARGS_NONE());
+  mrb_define_method(mrb, s, "wait", mrb_timer_sched_wait, MRB_ARGS_NONE());
+  mrb_define_method(mrb, s, "shard", mrb_timer_sched_shard, MRB_ARGS_NONE());
+  mrb_define_method(mrb, s, "retry_timer_usec", mrb_timer_sched_retry_timer_usec, MRB_ARGS_NONE());
+  mrb_define_class_method(mrb, s, "pending", mrb_timer_sched_pending, MRB_ARGS_NONE());
+}
+
+#endif
@@ -0,0 +1,89 @@
+#define _GNU_SOURCE 1
+
+#include <mruby.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "timer_thread.h"
+
+#ifndef __APPLE__
+
+/*
+ * Shards of the thread backed backends (dispatcher, scheduler, wheel):
+ * shard n runs its thread pinned to CPU n, so that timers set up by a worker
+ * fire on that worker's core. The unpinned default instance is shard -1.
+ */
+
+int mrb_timer_shard_count(void)
+{
+  long n = sysconf(_SC_NPROCESSORS_CONF);
+
+  if (n < 1) {
+    return 1;
+  }
+  return n > MRB_TIMER_MAX_SHARDS ? MRB_TIMER_MAX_SHARDS : (int)n;
+}
+
+/* nil => -1, otherwise an Integer in 0...shards */
+int mrb_timer_shard_arg(mrb_state *mrb, mrb_value v)
+{
+  mrb_int shard;
+
+  if (mrb_nil_p(v)) {
+    return -1;
+  }
+  if (!mrb_fixnum_p(v)) {
+    mrb_raise(mrb, E_TYPE_ERROR, "shard must be an Integer");
+  }
+  shard = mrb_fixnum(v);
+  if (shard < 0 || shard >= mrb_timer_shard_count()) {
+    mrb_raisef(mrb, E_ARGUMENT_ERROR, "shard out of range (%S)", v);
+  }
+  return (int)shard;
+}
+
+/* Pin the threads created with attr, a no-op for the default shard */
+void mrb_timer_shard_attr(pthread_attr_t *attr, int shard)
+{
+#ifdef __linux__
+  cpu_set_t set;
+
+  if (shard < 0) {
+    return;
+  }
+  CPU_ZERO(&set);
+  CPU_SET(shard, &set);
+  pthread_attr_setaffinity_np(attr, sizeof(cpu_set_t), &set);
+#endif
+}
+
+static mrb_value mrb_timer_shards(mrb_state *mrb, mrb_value self)
+{
+  return mrb_fixnum_value(mrb_timer_shard_count());
+}
+
+/* Shard of the CPU the calling thread runs on, for the timers of a worker */
+static mrb_value mrb_timer_current_shard(mrb_state *mrb, mrb_value self)
+{
+#ifdef __linux__
+  int cpu = sched_getcpu();
+
+  if (cpu == -1) {
+    mrb_sys_fail(mrb, "sched_getcpu");
+  }
+  return mrb_fixnum_value(cpu % mrb_timer_shard_count());
+#else
+  return mrb_fixnum_value(0);
+#endif
+}
+
+void mrb_timer_define_shard(mrb_state *mrb, struct RClass *timer)
+{
+  mrb_define_module_function(mrb, timer, "shards", mrb_timer_shards, MRB_ARGS_NONE());
+  mrb_define_module_function(mrb, timer, "current_shard", mrb_timer_current_shard, MRB_ARGS_NONE());
+}
+
+#endif
@@ -0,0 +1,308 @@
+#define _GNU_SOURCE 1
+
+#include <mruby.h>
+#include <mruby/array.h>
+#include <mruby/hash.h>
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/signalfd.h>
+#endif
+
+#include "timer_thread.h"
+
+#ifndef __APPLE__
+
+/*
+ * Timer identity on the signal itself: SIGEV_SIGNAL timers carry their id in
+ * sival_int, and the forwarding paths (SIGEV_THREAD helper, dispatcher,
+ * wheel) queue their signal with the same value. One RT signal can then
+ * serve any number of timers, Timer.dispatch looks the id up.
+ *
+ * Timer.wait_any reaps the queued signals in batches without running any
+ * handler: through a per-thread signalfd on Linux, looped sigtimedwait
+ * elsewhere.
+ */
+
+#define WAIT_BATCH 64
+
+void mrb_timer_send_signal(int signo, int has_thread, pthread_t thread_id, uint32_t id)
+{
+  union sigval sv;
+
+  sv.sival_int = (int)id;
+  if (has_thread) {
+#if defined(__linux__) && defined(__GLIBC__)
+    pthread_sigqueue(thread_id, signo, sv);
+#else
+    pthread_kill(thread_id, signo);
+#endif
+  } else {
+    sigqueue(getpid(), signo, sv);
+  }
+}
+
+/*
+ * Timer.sigwaitinfo(signal, timeout_msec = nil) => siginfo Hash, nil on timeout
+ *
+ * Blocks the signal in the calling thread and waits for it. Process directed
+ * signals can land in any thread that leaves it unblocked, so target the
+ * waiting thread with thread_id: or block the signal everywhere.
+ */
+static mrb_value mrb_timer_sigwaitinfo(mrb_state *mrb, mrb_value self)
+{
+  mrb_value vsig, vtimeout = mrb_nil_value(), ret;
+  sigset_t set;
+  siginfo_t info;
+  struct timespec ts;
+  mrb_int timeout_msec;
+  int signo, r;
+
+  if (mrb_get_args(mrb, "o|o", &vsig, &vtimeout) == -1) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot get arguments");
+  }
+  signo = mrb_timer_to_signo(mrb, vsig);
+  if (signo <= 0) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "Invalid value for signal");
+  }
+  if (!mrb_nil_p(vtimeout)) {
+    timeout_msec = mrb_fixnum(mrb_to_int(mrb, vtimeout));
+    if (timeout_msec < 0) {
+      mrb_raise(mrb, E_ARGUMENT_ERROR, "Timeout must be 0 or positive");
+    }
+    ts.tv_sec = (time_t)(timeout_msec / 1000);
+    ts.tv_nsec = (long)(timeout_msec % 1000) * 1000000L;
+  }
+
+  sigemptyset(&set);
+  sigaddset(&set, signo);
+  pthread_sigmask(SIG_BLOCK, &set, NULL);
+  do {
+    r = mrb_nil_p(vtimeout) ? sigwaitinfo(&set, &info) : sigtimedwait(&set, &info, &ts);
+  } while (r == -1 && errno == EINTR);
+  if (r == -1) {
+    if (errno == EAGAIN) {
+      return mrb_nil_value();
+    }
+    mrb_sys_fail(mrb, "sigwaitinfo");
+  }
+
+  ret = mrb_hash_new_capa(mrb, 4);
+  mrb_hash_set(mrb, ret, mrb_symbol_value(mrb_intern_lit(mrb, "signo")), mrb_fixnum_value(info.si_signo));
+  mrb_hash_set(mrb, ret, mrb_symbol_value(mrb_intern_lit(mrb, "code")), mrb_fixnum_value(info.si_code));
+  mrb_hash_set(mrb, ret, mrb_symbol_value(mrb_intern_lit(mrb, "value")),
+               mrb_fixnum_value((mrb_int)(uint32_t)info.si_value.sival_int));
+  /* expirations merged into this signal, only the kernel timer knows them */
+  mrb_hash_set(mrb, ret, mrb_symbol_value(mrb_intern_lit(mrb, "overrun")),
+               mrb_fixnum_value(info.si_code == SI_TIMER && info.si_overrun > 0 ? info.si_overrun : 0));
+  return ret;
+}
+
+#ifdef __linux__
+/* signalfd of a thread, re-pointed at the signal set of each call */
+struct mrb_timer_sigfd {
+  int fd;
+  sigset_t set;
+};
+
+static pthread_key_t sigfd_key;
+static pthread_once_t sigfd_once = PTHREAD_ONCE_INIT;
+static int sigfd_errno = 0;
+
+static void sigfd_destroy(void *p)
+{
+  struct mrb_timer_sigfd *st = (struct mrb_timer_sigfd *)p;
+
+  if (st->fd != -1) {
+    close(st->fd);
+  }
+  free(st);
+}
+
+static void sigfd_setup(void)
+{
+  sigfd_errno = pthread_key_create(&sigfd_key, sigfd_destroy);
+}
+
+/* returns -1 with errno on failure */
+static int sigfd_get(const sigset_t *set)
+{
+  struct mrb_timer_sigfd *st;
+  int fd;
+
+  pthread_once(&sigfd_once, sigfd_setup);
+  if (sigfd_errno) {
+    errno = sigfd_errno;
+    return -1;
+  }
+  st = (struct mrb_timer_sigfd *)pthread_getspecific(sigfd_key);
+  if (!st) {
+    st = (struct mrb_timer_sigfd *)calloc(1, sizeof(struct mrb_timer_sigfd));
+    if (!st) {
+      errno = ENOMEM;
+      return -1;
+    }
+    st->fd = -1;
+    pthread_setspecific(sigfd_key, st);
+  }
+  if (st->fd == -1 || memcmp(&st->set, set, sizeof(sigset_t)) != 0) {
+    fd = signalfd(st->fd, set, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd == -1) {
+      return -1;
+    }
+    st->fd = fd;
+    st->set = *set;
+  }
+  return st->fd;
+}
+#endif
+
+static void wait_push(mrb_state *mrb, mrb_value ret, uint32_t id, int code, int overrun, int signo)
+{
+  mrb_value ev[3];
+  int ai = mrb_gc_arena_save(mrb);
+
+  ev[0] = mrb_fixnum_value((mrb_int)id);
+  ev[1] = mrb_fixnum_value(1 + (code == SI_TIMER && overrun > 0 ? (mrb_int)overrun : 0));
+  ev[2] = mrb_fixnum_value(signo);
+  mrb_ary_push(mrb, ret, mrb_ary_new_from_values(mrb, 3, ev));
+  mrb_gc_arena_restore(mrb, ai);
+}
+
+/*
+ * Timer.wait_any(signals, timeout_msec = nil, max = 256)
+ *   => [[timer_id, expirations, signo], ...]
+ *
+ * Blocks signals (one or an Array) in the calling thread, waits up to
+ * timeout_msec (forever with nil, 0 polls) for any of them, then reaps up
+ * to max queued ones. expirations is 1 plus the kernel overrun count. An
+ * empty Array means the timeout passed.
+ */
+static mrb_value mrb_timer_wait_any(mrb_state *mrb, mrb_value self)
+{
+  mrb_value vsigs, vtimeout = mrb_nil_value(), ret;
+  mrb_int max = 256, timeout_msec = -1, i;
+  sigset_t set;
+  int signo;
+
+  if (mrb_get_args(mrb, "o|oi", &vsigs, &vtimeout, &max) == -1) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot get arguments");
+  }
+  if (max <= 0) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "max must be positive");
+  }
+  if (!mrb_nil_p(vtimeout)) {
+    timeout_msec = mrb_fixnum(mrb_to_int(mrb, vtimeout));
+    if (timeout_msec < 0) {
+      mrb_raise(mrb, E_ARGUMENT_ERROR, "Timeout must be 0 or positive");
+    }
+  }
+
+  sigemptyset(&set);
+  if (mrb_array_p(vsigs)) {
+    for (i = 0; i < RARRAY_LEN(vsigs); i++) {
+      signo = mrb_timer_to_signo(mrb, RARRAY_PTR(vsigs)[i]);
+      if (signo <= 0) {
+        mrb_raise(mrb, E_ARGUMENT_ERROR, "Invalid value for signal");
+      }
+      sigaddset(&set, signo);
+    }
+  } else {
+    signo = mrb_timer_to_signo(mrb, vsigs);
+    if (signo <= 0) {
+      mrb_raise(mrb, E_ARGUMENT_ERROR, "Invalid value for signal");
+    }
+    sigaddset(&set, signo);
+  }
+  pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+  ret = mrb_ary_new(mrb);
+#ifdef __linux__
+  {
+    struct signalfd_siginfo buf[WAIT_BATCH];
+    struct pollfd pfd;
+    size_t want, got, k;
+    ssize_t len;
+    mrb_int n = 0;
+    int fd = sigfd_get(&set), r;
+
+    if (fd == -1) {
+      mrb_sys_fail(mrb, "signalfd");
+    }
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    do {
+      r = poll(&pfd, 1, timeout_msec > INT_MAX ? INT_MAX : (int)timeout_msec);
+    } while (r == -1 && errno == EINTR);
+    if (r == -1) {
+      mrb_sys_fail(mrb, "poll");
+    }
+
+    /* one read reaps up to WAIT_BATCH signals */
+    while (r > 0 && n < max) {
+      want = (size_t)(max - n < WAIT_BATCH ? max - n : WAIT_BATCH);
+      len = read(fd, buf, want * sizeof(struct signalfd_siginfo));
+      if (len <= 0) {
+        break;
+      }
+      got = (size_t)len / sizeof(struct signalfd_siginfo);
+      for (k = 0; k < got; k++) {
+        wait_push(mrb, ret, (uint32_t)buf[k].ssi_int, buf[k].ssi_code, (int)buf[k].ssi_overrun, (int)buf[k].ssi_signo);
+      }
+      n += (mrb_int)got;
+      if (got < want) {
+        break;
+      }
+    }
+  }
+#else
+  {
+    struct timespec ts;
+    siginfo_t info;
+    mrb_int n;
+    int r;
+
+    ts.tv_sec = (time_t)(timeout_msec / 1000);
+    ts.tv_nsec = (long)(timeout_msec % 1000) * 1000000L;
+    for (n = 0; n < max; n++) {
+      do {
+        r = n == 0 && timeout_msec < 0 ? sigwaitinfo(&set, &info) : sigtimedwait(&set, &info, &ts);
+      } while (r == -1 && errno == EINTR);
+      if (r == -1) {
+        if (errno == EAGAIN) {
+          break;
+        }
+        mrb_sys_fail(mrb, "sigtimedwait");
+      }
+      wait_push(mrb, ret, (uint32_t)info.si_value.sival_int, info.si_code, info.si_overrun, info.si_signo);
+      /* the rest only reaps what is already queued */
+      ts.tv_sec = 0;
+      ts.tv_nsec = 0;
+    }
+  }
+#endif
+  return ret;
+}
+
+/* pthread id of the calling thread, for thread_id: like SignalThread#thread_id */
+static mrb_value mrb_timer_thread_id(mrb_state *mrb, mrb_value self)
+{
+  return mrb_float_value(mrb, (mrb_float)pthread_self());
+}
+
+void mrb_timer_define_siginfo(mrb_state *mrb, struct RClass *timer)
+{
+  mrb_define_module_function(mrb, timer, "thread_id", mrb_timer_thread_id, MRB_ARGS_NONE());
+  mrb_define_module_function(mrb, timer, "sigwaitinfo", mrb_timer_sigwaitinfo, MRB_ARGS_ARG(1, 1));
+  mrb_define_module_function(mrb, timer, "wait_any", mrb_timer_wait_any, MRB_ARGS_ARG(1, 2));
+}
+
+#endif
@@ -0,0 +1,154 @@
+#define _GNU_SOURCE 1
+
+#include <mruby.h>
+#include <mruby/hash.h>
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "timer_thread.h"
+
+#ifndef __APPLE__
+
+/*
+ * Per timer lateness histogram, filled by the notification paths (SIGEV_THREAD
+ * function, dispatcher, wheel) without any lock: counters are relaxed atomics,
+ * min and max are CAS loops. Readers get a consistent enough snapshot.
+ */
+
+static int mrb_timer_stats_bucket(uint64_t ns)
+{
+  return ns ? 63 - __builtin_clzll(ns) : 0;
+}
+
+void mrb_timer_stats_reset(struct mrb_timer_stats *st)
+{
+  int i;
+
+  __atomic_store_n(&st->fired, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&st->overruns, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&st->min_ns, UINT64_MAX, __ATOMIC_RELAXED);
+  __atomic_store_n(&st->max_ns, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&st->sum_ns, 0, __ATOMIC_RELAXED);
+  for (i = 0; i < MRB_TIMER_STATS_BUCKETS; i++) {
+    __atomic_store_n(&st->hist[i], 0, __ATOMIC_RELAXED);
+  }
+}
+
+void mrb_timer_stats_arm(struct mrb_timer_stats *st, uint64_t first_ns, uint64_t interval_ns)
+{
+  __atomic_store_n(&st->next_index, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&st->interval_ns, interval_ns, __ATOMIC_RELAXED);
+  __atomic_store_n(&st->first_ns, first_ns, __ATOMIC_RELEASE);
+}
+
+void mrb_timer_stats_record(struct mrb_timer_stats *st, uint64_t lateness_ns, uint64_t skipped)
+{
+  uint64_t cur;
+
+  __atomic_add_fetch(&st->fired, 1, __ATOMIC_RELAXED);
+  mrb_timer_metric_add(MRB_TIMER_METRIC_FIRES, 1);
+  if (skipped) {
+    __atomic_add_fetch(&st->overruns, skipped, __ATOMIC_RELAXED);
+    mrb_timer_metric_add(MRB_TIMER_METRIC_OVERRUNS, (int64_t)skipped);
+  }
+  __atomic_add_fetch(&st->sum_ns, lateness_ns, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&st->hist[mrb_timer_stats_bucket(lateness_ns)], 1, __ATOMIC_RELAXED);
+
+  cur = __atomic_load_n(&st->min_ns, __ATOMIC_RELAXED);
+  while (lateness_ns < cur &&
+         !__atomic_compare_exchange_n(&st->min_ns, &cur, lateness_ns, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+  cur = __atomic_load_n(&st->max_ns, __ATOMIC_RELAXED);
+  while (lateness_ns > cur &&
+         !__atomic_compare_exchange_n(&st->max_ns, &cur, lateness_ns, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+/*
+ * The expiry due at or just before now is the one being delivered; any
+ * expected expiry between the previous delivery and it was merged into this
+ * one and counts as an overrun.
+ */
+void mrb_timer_stats_record_now(struct mrb_timer_stats *st)
+{
+  struct timespec ts;
+  uint64_t first, interval, now, index = 0, expected, prev;
+
+  first = __atomic_load_n(&st->first_ns, __ATOMIC_ACQUIRE);
+  if (!first) {
+    /* a late notification of a disarmed timer */
+    return;
+  }
+  interval = __atomic_load_n(&st->interval_ns, __ATOMIC_RELAXED);
+  clock_gettime(st->clockid, &ts);
+  now = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+
+  if (now < first) {
+    expected = now;
+  } else {
+    if (interval) {
+      index = (now - first) / interval;
+    }
+    expected = first + index * interval;
+  }
+  prev = __atomic_exchange_n(&st->next_index, index + 1, __ATOMIC_RELAXED);
+  mrb_timer_stats_record(st, now - expected, index > prev ? index - prev : 0);
+}
+
+/* upper bound of the bucket holding the given quantile, capped by the maximum */
+static uint64_t mrb_timer_stats_quantile(uint64_t *hist, uint64_t total, uint64_t max, int permille)
+{
+  uint64_t rank = (total * (uint64_t)permille + 999) / 1000, seen = 0, upper;
+  int i;
+
+  for (i = 0; i < MRB_TIMER_STATS_BUCKETS; i++) {
+    seen += hist[i];
+    if (seen >= rank) {
+      upper = i >= 63 ? UINT64_MAX : (2ULL << i) - 1;
+      return upper < max ? upper : max;
+    }
+  }
+  return max;
+}
+
+#define STATS_SET(key, val) mrb_hash_set(mrb, ret, mrb_symbol_value(mrb_intern_lit(mrb, key)), val)
+
+/* {fired:, overruns:, min_ns:, max_ns:, mean_ns:, p50_ns:, p99_ns:}, lateness is nil before the first expiry */
+mrb_value mrb_timer_stats_to_hash(mrb_state *mrb, struct mrb_timer_stats *st)
+{
+  uint64_t hist[MRB_TIMER_STATS_BUCKETS], total = 0, fired, min, max, sum;
+  mrb_value ret;
+  int i;
+
+  fired = __atomic_load_n(&st->fired, __ATOMIC_RELAXED);
+  min = __atomic_load_n(&st->min_ns, __ATOMIC_RELAXED);
+  max = __atomic_load_n(&st->max_ns, __ATOMIC_RELAXED);
+  sum = __atomic_load_n(&st->sum_ns, __ATOMIC_RELAXED);
+  for (i = 0; i < MRB_TIMER_STATS_BUCKETS; i++) {
+    hist[i] = __atomic_load_n(&st->hist[i], __ATOMIC_RELAXED);
+    total += hist[i];
+  }
+
+  ret = mrb_hash_new_capa(mrb, 7);
+  STATS_SET("fired", mrb_fixnum_value((mrb_int)fired));
+  STATS_SET("overruns", mrb_fixnum_value((mrb_int)__atomic_load_n(&st->overruns, __ATOMIC_RELAXED)));
+  if (!total) {
+    STATS_SET("min_ns", mrb_nil_value());
+    STATS_SET("max_ns", mrb_nil_value());
+    STATS_SET("mean_ns", mrb_nil_value());
+    STATS_SET("p50_ns", mrb_nil_value());
+    STATS_SET("p99_ns", mrb_nil_value());
+    return ret;
+  }
+  STATS_SET("min_ns", mrb_fixnum_value((mrb_int)min));
+  STATS_SET("max_ns", mrb_fixnum_value((mrb_int)max));
+  STATS_SET("mean_ns", mrb_fixnum_value((mrb_int)(sum / total)));
+  STATS_SET("p50_ns", mrb_fixnum_value((mrb_int)mrb_timer_stats_quantile(hist, total, max, 500)));
+  STATS_SET("p99_ns", mrb_fixnum_value((mrb_int)mrb_timer_stats_quantile(hist, total, max, 990)));
+
+  return ret;
+}
+
+#endif
@@ -14,10 +14,14 @@
 #include <math.h>
 #include <pthread.h>
 #include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
+#include "timer_thread.h"
+
 #define DONE mrb_gc_arena_restore(mrb, 0);
 
 /* OSX does not support POSIX Timer... */
@@ -186,10 +190,40 @@ static int signm2signo(const char *nm)
   return 0;
 }
 
-static int mrb_to_signo(mrb_state *mrb, mrb_value vsig)
+/*
+ * Symbol => signo for every name of siglist and RT0..RTn, with and without
+ * the SIG prefix. Built once per mrb_state at gem init, so that a Symbol
+ * signal costs one hash lookup instead of a strcmp scan.
+ */
+#define MRB_TIMER_SIGNO_TABLE mrb_intern_lit(mrb, "__timer_signo_table__")
+
+static void mrb_timer_build_signo_table(mrb_state *mrb)
+{
+  const struct signals *sigs;
+  mrb_value table = mrb_hash_new(mrb);
+  char buf[32];
+  int i;
+
+  for (sigs = siglist; sigs->signm; sigs++) {
+    snprintf(buf, sizeof(buf), "SIG%s", sigs->signm);
+    mrb_hash_set(mrb, table, mrb_symbol_value(mrb_intern_cstr(mrb, sigs->signm)), mrb_fixnum_value(sigs->signo));
+    mrb_hash_set(mrb, table, mrb_symbol_value(mrb_intern_cstr(mrb, buf)), mrb_fixnum_value(sigs->signo));
+  }
+  for (i = 0; SIGRTMIN + i <= SIGRTMAX; i++) {
+    snprintf(buf, sizeof(buf), "RT%d", i);
+    mrb_hash_set(mrb, table, mrb_symbol_value(mrb_intern_cstr(mrb, buf)), mrb_fixnum_value(SIGRTMIN + i));
+    snprintf(buf, sizeof(buf), "SIGRT%d", i);
+    mrb_hash_set(mrb, table, mrb_symbol_value(mrb_intern_cstr(mrb, buf)), mrb_fixnum_value(SIGRTMIN + i));
+  }
+  /* hidden from Ruby, the name has no @ */
+  mrb_iv_set(mrb, mrb_obj_value(mrb->object_class), MRB_TIMER_SIGNO_TABLE, table);
+}
+
+int mrb_timer_to_signo(mrb_state *mrb, mrb_value vsig)
 {
   int sig = -1;
   const char *s;
+  mrb_value table, cached;
 
   switch (mrb_type(vsig)) {
   case MRB_TT_FIXNUM:
@@ -199,6 +233,13 @@ static int mrb_to_signo(mrb_state *mrb, mrb_value vsig)
     }
     break;
   case MRB_TT_SYMBOL:
+    table = mrb_iv_get(mrb, mrb_obj_value(mrb->object_class), MRB_TIMER_SIGNO_TABLE);
+    if (mrb_hash_p(table)) {
+      cached = mrb_hash_fetch(mrb, table, vsig, mrb_undef_value());
+      if (!mrb_undef_p(cached)) {
+        return (int)mrb_fixnum(cached);
+      }
+    }
     s = mrb_sym2name(mrb, mrb_symbol(vsig));
     if (!s) {
       mrb_raise(mrb, E_ARGUMENT_ERROR, "bad signal");
@@ -221,31 +262,188 @@ static int mrb_to_signo(mrb_state *mrb, mrb_value vsig)
   return sig;
 }
 
-struct mrb_timer_posix_thread_param {
-  int signo;
-  pthread_t thread_id;
-};
+/* One block per timer: the kernel timer id and the thread param are kept inline */
+struct mrb_timer_pool;
 
 typedef struct {
-  timer_t *timer_ptr;
+  timer_t timer;
+  uint32_t id;
   int timer_signo;
   clock_t clockid;
-  struct mrb_timer_posix_thread_param *thread_param_ptr;
+  struct mrb_timer_posix_thread_param thread_param; /* SIGEV_THREAD target, see has_thread */
+  int has_thread;
+  struct mrb_timer_pool *pool; /* owner pool of a pooled timer */
+  uintptr_t dispatch_handle; /* non 0 when notified through the dispatcher thread */
+  int shard;                 /* of the dispatcher, -1 for the default one */
+  /* expiration bookkeeping, all in nsec on the timer's own clock */
+  uint64_t slack_ns; /* expiries are rounded up to multiples of it, 0 for exact */
+  uint64_t first_ns; /* absolute time of the first expiry, 0 while disarmed */
+  uint64_t interval_ns;
+  uint64_t expired_base; /* expirations of the previous arms */
+  uint64_t expired_read; /* expirations already reported */
+  int metric_clock; /* MRB_TIMER_METRIC_LIVE_* counted for the timer, -1 until created */
+  int metric_notify;
+  struct mrb_timer_worker_link worker_link; /* attached while owned by a Timer.worker */
+  /* aligned schedule of start_every, every_ns is 0 for any other arm */
+  uint64_t every_ns;
+  uint64_t every_offset_ns;
 } mrb_timer_posix_data;
 
+#define MRB_TIMER_NSEC_PER_SEC 1000000000ULL
+
+static uint64_t mrb_timer_clock_ns(clockid_t clockid)
+{
+  struct timespec ts;
+  if (clock_gettime(clockid, &ts) == -1) {
+    return 0;
+  }
+  return (uint64_t)ts.tv_sec * MRB_TIMER_NSEC_PER_SEC + (uint64_t)ts.tv_nsec;
+}
+
+/* The first t > now_ns with t = offset_ns (mod period_ns) */
+uint64_t mrb_timer_align_next(uint64_t now_ns, uint64_t period_ns, uint64_t offset_ns)
+{
+  uint64_t off = offset_ns % period_ns;
+
+  if (now_ns < off) {
+    return off;
+  }
+  return (now_ns - off) / period_ns * period_ns + period_ns + off;
+}
+
+/* Expirations of the current arm, computed from the clock so that coalesced signals are still counted */
+static uint64_t mrb_timer_posix_expired(mrb_timer_posix_data *data, uint64_t now)
+{
+  if (!data->first_ns || now < data->first_ns) {
+    return 0;
+  }
+  if (!data->interval_ns) {
+    return 1;
+  }
+  return 1 + (now - data->first_ns) / data->interval_ns;
+}
+
+/*
+ * Arm (or disarm with value_ns 0) the kernel timer and close the books of the
+ * previous arm. value_ns is relative, or absolute on the timer's clock when
+ * flags has TIMER_ABSTIME.
+ *
+ * With slack, the deadline is rounded up to the next multiple of slack_ns on
+ * the clock and the interval to a multiple of it, so that every timer of the
+ * same slack expires on a shared grid and the kernel wakes up once for them.
+ */
+static int mrb_timer_posix_settime(mrb_timer_posix_data *data, int flags, uint64_t value_ns, uint64_t interval_ns)
+{
+  struct itimerspec ts, old;
+  uint64_t now;
+
+  if (data->slack_ns && value_ns) {
+    uint64_t slack = data->slack_ns;
+    if (!(flags & TIMER_ABSTIME)) {
+      value_ns += mrb_timer_clock_ns(data->clockid);
+      flags |= TIMER_ABSTIME;
+    }
+    value_ns = (value_ns + slack - 1) / slack * slack;
+    interval_ns = (interval_ns + slack - 1) / slack * slack;
+  }
+
+  ts.it_value.tv_sec = (time_t)(value_ns / MRB_TIMER_NSEC_PER_SEC);
+  ts.it_value.tv_nsec = (long)(value_ns % MRB_TIMER_NSEC_PER_SEC);
+  ts.it_interval.tv_sec = (time_t)(interval_ns / MRB_TIMER_NSEC_PER_SEC);
+  ts.it_interval.tv_nsec = (long)(interval_ns % MRB_TIMER_NSEC_PER_SEC);
+
+  if (timer_settime(data->timer, flags, &ts, &old) == -1) {
+    return -1;
+  }
+  /* a disarm counts as a cancel only when the timer was still armed */
+  if (value_ns) {
+    mrb_timer_metric_add(MRB_TIMER_METRIC_ARMS, 1);
+  } else if (old.it_value.tv_sec || old.it_value.tv_nsec) {
+    mrb_timer_metric_add(MRB_TIMER_METRIC_CANCELS, 1);
+  }
+
+  now = mrb_timer_clock_ns(data->clockid);
+  data->expired_base += mrb_timer_posix_expired(data, now);
+  if (!value_ns) {
+    data->first_ns = 0;
+  } else if (flags & TIMER_ABSTIME) {
+    /* a deadline in the past expires at once */
+    data->first_ns = value_ns > now ? value_ns : now;
+  } else {
+    data->first_ns = now + value_ns;
+  }
+  data->interval_ns = interval_ns;
+  data->every_ns = 0;
+  mrb_timer_stats_arm(&data->thread_param.stats, data->first_ns, interval_ns);
+  return 0;
+}
+
+static int mrb_timer_metric_clock(clockid_t clockid)
+{
+  switch (clockid) {
+  case CLOCK_MONOTONIC:
+#ifdef CLOCK_BOOTTIME
+  case CLOCK_BOOTTIME:
+#endif
+    return MRB_TIMER_METRIC_LIVE_MONOTONIC;
+  case CLOCK_REALTIME:
+    return MRB_TIMER_METRIC_LIVE_REALTIME;
+  case CLOCK_PROCESS_CPUTIME_ID:
+  case CLOCK_THREAD_CPUTIME_ID:
+    return MRB_TIMER_METRIC_LIVE_CPUTIME;
+  default:
+    /* pthread_getcpuclockid and clock_getcpuclockid ids are negative */
+    return clockid < 0 ? MRB_TIMER_METRIC_LIVE_CPUTIME : MRB_TIMER_METRIC_LIVE_OTHER_CLOCK;
+  }
+}
+
+static void mrb_timer_posix_data_discard(mrb_state *mrb, mrb_timer_posix_data *data)
+{
+  mrb_timer_worker_detach(&data->worker_link);
+  if (data->metric_clock >= 0) {
+    mrb_timer_metric_add(MRB_TIMER_METRIC_LIVE_POSIX, -1);
+    mrb_timer_metric_add((enum mrb_timer_metric)data->metric_clock, -1);
+    mrb_timer_metric_add((enum mrb_timer_metric)data->metric_notify, -1);
+  }
+#ifdef MRB_TIMER_HAVE_DISPATCHER
+  if (data->dispatch_handle) {
+    mrb_timer_dispatcher_unregister(data->shard, data->dispatch_handle);
+  }
+#endif
+  mrb_free(mrb, data);
+}
+
+static void mrb_timer_pool_release(mrb_state *mrb, mrb_timer_posix_data *data);
+
 static void mrb_timer_posix_free(mrb_state *mrb, void *p)
 {
   mrb_timer_posix_data *data = (mrb_timer_posix_data *)p;
-  timer_delete(*data->timer_ptr);
-  mrb_free(mrb, data->timer_ptr);
-  if (data->thread_param_ptr) {
-    mrb_free(mrb, data->thread_param_ptr);
+  timer_t timer;
+  if (!data) {
+    return;
   }
-  mrb_free(mrb, data);
+  /* a pooled timer goes back to its pool instead */
+  if (data->pool) {
+    mrb_timer_pool_release(mrb, data);
+    return;
+  }
+  /* discard detaches from the worker first: it must not disarm a deleted (maybe reused) timer id */
+  timer = data->timer;
+  mrb_timer_posix_data_discard(mrb, data);
+  timer_delete(timer);
 }
 
 static const struct mrb_data_type mrb_timer_posix_data_type = {"mrb_timer_posix_data", mrb_timer_posix_free};
 
+static mrb_timer_posix_data *mrb_timer_posix_get(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_posix_data *data = DATA_PTR(self);
+  if (!data) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Timer already closed");
+  }
+  return data;
+}
+
 static mrb_value mrb_rtsignal_get(mrb_state *mrb, mrb_value self)
 {
   mrb_int idx;
@@ -260,184 +458,837 @@ static mrb_value mrb_rtsignal_get(mrb_state *mrb, mrb_value self)
   return mrb_fixnum_value(SIGRTMIN + (int)idx);
 }
 
+/* target of pooled SIGEV_THREAD timers, rewritten by checkout while a helper of the previous user may run */
+static pthread_mutex_t mrb_timer_pool_params_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static void mrb_timer_posix_thread_func(union sigval sv)
 {
   struct mrb_timer_posix_thread_param *param = (struct mrb_timer_posix_thread_param *)(sv.sival_ptr);
-  pthread_kill(param->thread_id, param->signo);
+  struct mrb_timer_posix_thread_param p;
+
+  /* pooled is set once at creation, the rest is copied in one go */
+  if (param->pooled) {
+    pthread_mutex_lock(&mrb_timer_pool_params_lock);
+  }
+  mrb_timer_stats_record_now(&param->stats);
+  p.signo = param->signo;
+  p.has_thread = param->has_thread;
+  p.thread_id = param->thread_id;
+  p.queued = param->queued;
+  p.worker = param->worker;
+  p.id = param->id;
+  if (param->pooled) {
+    pthread_mutex_unlock(&mrb_timer_pool_params_lock);
+  }
+
+  if (p.queued) {
+    mrb_timer_ring_push(p.id, 1);
+    return;
+  }
+  if (p.signo <= 0) {
+    return;
+  }
+  if (p.worker) {
+    mrb_timer_worker_send_signal(p.worker, p.signo, p.id);
+    return;
+  }
+  mrb_timer_send_signal(p.signo, p.has_thread, p.thread_id, p.id);
 }
 
 #define MRB_TIMER_POSIX_KEY_SIGNO mrb_intern_lit(mrb, "signal")
 #define MRB_TIMER_POSIX_KEY_CLOCK_ID mrb_intern_lit(mrb, "clock_id")
 #define MRB_TIMER_POSIX_KEY_THREAD_ID mrb_intern_lit(mrb, "thread_id")
-
-/* initialize */
-static mrb_value mrb_timer_posix_init(mrb_state *mrb, mrb_value self)
-{
-  mrb_timer_posix_data *data;
-  timer_t *timer_ptr;
-  mrb_value options = mrb_nil_value();
-  mrb_value has_signo_key, signo, clock_arg, thread_id_arg;
-  clockid_t clockid = CLOCK_REALTIME;
+#define MRB_TIMER_POSIX_KEY_DISPATCHER mrb_intern_lit(mrb, "dispatcher")
+#define MRB_TIMER_POSIX_KEY_QUEUE mrb_intern_lit(mrb, "queue")
+#define MRB_TIMER_POSIX_KEY_SLACK mrb_intern_lit(mrb, "slack")
+#define MRB_TIMER_POSIX_KEY_CPU_BUDGET mrb_intern_lit(mrb, "cpu_budget")
+#define MRB_TIMER_POSIX_KEY_SHARD mrb_intern_lit(mrb, "shard")
+#define MRB_TIMER_POSIX_KEY_WORKER mrb_intern_lit(mrb, "worker")
+
+/* default for thread_id: timers without dispatcher: option */
+static int mrb_timer_posix_use_dispatcher = 0;
+
+/* Options of Timer::POSIX.new, parsed once so that create_many can reuse them */
+struct mrb_timer_posix_options {
+  clockid_t clockid;
+  int has_signo; /* signal: given */
+  int signo;     /* 0 for signal: nil */
+  int has_thread;
   pthread_t thread_id;
-  struct mrb_timer_posix_thread_param *param = NULL;
-
-  struct sigevent sev;
-  memset(&sev, 0, sizeof(struct sigevent));
-  sev.sigev_signo = -1;
+  int dispatcher;
+  int pooled; /* always notify through thread_param, so that the target can be changed */
+  int queued; /* push expiries to the event queue through the dispatcher */
+  uint64_t slack_ns;
+  int shard; /* dispatcher shard, -1 for the default one */
+  uint32_t worker; /* Timer.worker handle, 0 for none */
+  pid_t worker_tid;
+};
 
-  if (mrb_get_args(mrb, "|o", &options) == -1) {
-    mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot get arguments");
+static void mrb_timer_posix_parse_options(mrb_state *mrb, mrb_value options, struct mrb_timer_posix_options *opts)
+{
+  mrb_value signo, clock_arg, thread_id_arg, use, slack, budget, worker;
+
+  opts->clockid = CLOCK_REALTIME;
+  opts->has_signo = 0;
+  opts->signo = SIGALRM;
+  opts->has_thread = 0;
+  opts->thread_id = 0;
+  opts->dispatcher = mrb_timer_posix_use_dispatcher;
+  opts->pooled = 0;
+  opts->queued = 0;
+  opts->slack_ns = 0;
+  opts->shard = -1;
+  opts->worker = 0;
+  opts->worker_tid = 0;
+
+  if (!mrb_hash_p(options)) {
+    return;
   }
 
-  /* Parse options as hash */
-  if (mrb_hash_p(options)) {
-    has_signo_key = mrb_funcall(mrb, options, "has_key?", 1, mrb_symbol_value(MRB_TIMER_POSIX_KEY_SIGNO));
-    if (mrb_bool(has_signo_key)) {
-      signo = mrb_hash_get(mrb, options, mrb_symbol_value(MRB_TIMER_POSIX_KEY_SIGNO));
-      /* handles nil as special... */
-      if (mrb_nil_p(signo)) {
-        sev.sigev_notify = SIGEV_NONE;
-        sev.sigev_signo = 0; /* mark as active */
-      } else {
-        int sno = mrb_to_signo(mrb, signo);
-        if (sno <= 0) {
-          mrb_raise(mrb, E_ARGUMENT_ERROR, "Invalid value for signal");
-        }
-        sev.sigev_notify = SIGEV_SIGNAL;
-        sev.sigev_signo = sno;
+  signo = mrb_hash_fetch(mrb, options, mrb_symbol_value(MRB_TIMER_POSIX_KEY_SIGNO), mrb_undef_value());
+  if (!mrb_undef_p(signo)) {
+    opts->has_signo = 1;
+    /* handles nil as special... */
+    if (mrb_nil_p(signo)) {
+      opts->signo = 0;
+    } else {
+      opts->signo = mrb_timer_to_signo(mrb, signo);
+      if (opts->signo <= 0) {
+        mrb_raise(mrb, E_ARGUMENT_ERROR, "Invalid value for signal");
       }
     }
+  }
 
-    clock_arg = mrb_hash_get(mrb, options, mrb_symbol_value(MRB_TIMER_POSIX_KEY_CLOCK_ID));
-    /* has key and is not nil */
-    if (mrb_fixnum_p(clock_arg)) {
-      clockid = (clockid_t)mrb_fixnum(clock_arg);
+  clock_arg = mrb_hash_get(mrb, options, mrb_symbol_value(MRB_TIMER_POSIX_KEY_CLOCK_ID));
+  /* has key and is not nil */
+  if (mrb_fixnum_p(clock_arg)) {
+    opts->clockid = (clockid_t)mrb_fixnum(clock_arg);
+  }
+
+  /* the CPU time clock of a thread: true for the calling one, or a thread_id */
+  budget = mrb_hash_get(mrb, options, mrb_symbol_value(MRB_TIMER_POSIX_KEY_CPU_BUDGET));
+  if (mrb_test(budget)) {
+    pthread_t target;
+    int err;
+
+    if (mrb_float_p(budget)) {
+      target = (pthread_t)mrb_float(budget);
+    } else if (mrb_type(budget) == MRB_TT_TRUE) {
+      target = pthread_self();
+    } else {
+      mrb_raise(mrb, E_ARGUMENT_ERROR, "cpu_budget must be true or a thread_id");
+    }
+    err = pthread_getcpuclockid(target, &opts->clockid);
+    if (err) {
+      errno = err;
+      mrb_sys_fail(mrb, "pthread_getcpuclockid");
     }
+  }
 
 #ifdef SIGEV_THREAD
-    thread_id_arg = mrb_hash_get(mrb, options, mrb_symbol_value(MRB_TIMER_POSIX_KEY_THREAD_ID));
-    /* has key and is not nil */
-    if (mrb_float_p(thread_id_arg)) {
-      thread_id = (pthread_t)mrb_float(thread_id_arg);
-      param = mrb_malloc(mrb, sizeof(struct mrb_timer_posix_thread_param));
-      param->thread_id = thread_id;
-      param->signo = sev.sigev_signo;
-      if (param->signo == -1) { /* By default handling */
-        param->signo = SIGALRM;
-      }
+  thread_id_arg = mrb_hash_get(mrb, options, mrb_symbol_value(MRB_TIMER_POSIX_KEY_THREAD_ID));
+  /* has key and is not nil */
+  if (mrb_float_p(thread_id_arg)) {
+    opts->thread_id = (pthread_t)mrb_float(thread_id_arg);
+    opts->has_thread = 1;
+  }
+#endif
 
-      sev.sigev_notify = SIGEV_THREAD;
-      sev.sigev_value.sival_ptr = (void *)param;
-      sev.sigev_notify_function = mrb_timer_posix_thread_func;
+  /* msec */
+  slack = mrb_hash_get(mrb, options, mrb_symbol_value(MRB_TIMER_POSIX_KEY_SLACK));
+  if (mrb_fixnum_p(slack)) {
+    if (mrb_fixnum(slack) < 0) {
+      mrb_raise(mrb, E_ARGUMENT_ERROR, "Slack must be 0 or positive");
     }
+    opts->slack_ns = (uint64_t)mrb_fixnum(slack) * 1000000ULL;
+  }
+
+  use = mrb_hash_get(mrb, options, mrb_symbol_value(MRB_TIMER_POSIX_KEY_DISPATCHER));
+  if (!mrb_nil_p(use)) {
+    opts->dispatcher = mrb_bool(use);
+  }
+
+  opts->shard = mrb_timer_shard_arg(mrb, mrb_hash_get(mrb, options, mrb_symbol_value(MRB_TIMER_POSIX_KEY_SHARD)));
+  if (opts->shard >= 0) {
+#ifdef MRB_TIMER_HAVE_DISPATCHER
+    /* notified by the dispatcher pinned to that CPU */
+    opts->dispatcher = 1;
+#else
+    mrb_raise(mrb, E_NOTIMP_ERROR, "shard: needs SIGEV_THREAD_ID");
 #endif
   }
 
-  data = (mrb_timer_posix_data *)DATA_PTR(self);
-  if (data) {
-    mrb_timer_posix_free(mrb, data);
+  /* true for the calling thread, or a Timer.worker handle; replaces thread_id: */
+  worker = mrb_hash_get(mrb, options, mrb_symbol_value(MRB_TIMER_POSIX_KEY_WORKER));
+  if (mrb_test(worker)) {
+    if (mrb_type(worker) == MRB_TT_TRUE) {
+      opts->worker = mrb_timer_worker_self();
+      if (!opts->worker) {
+        mrb_sys_fail(mrb, "Timer.worker");
+      }
+    } else if (mrb_fixnum_p(worker)) {
+      opts->worker = (uint32_t)mrb_fixnum(worker);
+    } else {
+      mrb_raise(mrb, E_TYPE_ERROR, "worker must be true or a Timer.worker handle");
+    }
+    if (mrb_timer_worker_lookup(opts->worker, &opts->thread_id, &opts->worker_tid) == -1) {
+      mrb_raise(mrb, E_ARGUMENT_ERROR, "worker thread has exited");
+    }
+    /* signal: nil only ties the timer's lifetime to the worker */
+    opts->has_thread = opts->signo != 0;
+    opts->dispatcher = 0;
   }
 
-  DATA_TYPE(self) = &mrb_timer_posix_data_type;
-  DATA_PTR(self) = NULL;
+  if (mrb_test(mrb_hash_get(mrb, options, mrb_symbol_value(MRB_TIMER_POSIX_KEY_QUEUE)))) {
+#ifdef MRB_TIMER_HAVE_DISPATCHER
+    /* no signal at all, the dispatcher reaps and queues */
+    opts->queued = 1;
+    opts->dispatcher = 1;
+    opts->signo = 0;
+    opts->has_signo = 1;
+    opts->has_thread = 0;
+#else
+    mrb_raise(mrb, E_NOTIMP_ERROR, "queue: needs SIGEV_THREAD_ID");
+#endif
+  }
+}
 
-  data = (mrb_timer_posix_data *)mrb_malloc(mrb, sizeof(mrb_timer_posix_data));
-  timer_ptr = (timer_t *)mrb_malloc(mrb, sizeof(timer_t));
+/* MRB_TIMER_METRIC_LIVE_* bucket of the notification the options ask for */
+static int mrb_timer_posix_metric_notify(const struct mrb_timer_posix_options *opts)
+{
+  if (opts->queued) {
+    return MRB_TIMER_METRIC_LIVE_QUEUED;
+  } else if (opts->has_thread) {
+    return MRB_TIMER_METRIC_LIVE_THREAD_TARGETED;
+  } else if (opts->signo) {
+    return MRB_TIMER_METRIC_LIVE_SIGNAL;
+  }
+  return MRB_TIMER_METRIC_LIVE_NO_SIGNAL;
+}
 
-  if (sev.sigev_signo < 0) {
-    if (timer_create(clockid, NULL, timer_ptr) == -1) {
-      mrb_sys_fail(mrb, "timer_create failed");
+/* Allocate the data and create its kernel timer, raises on failure */
+static mrb_timer_posix_data *mrb_timer_posix_create(mrb_state *mrb, const struct mrb_timer_posix_options *opts)
+{
+  mrb_timer_posix_data *data;
+  struct mrb_timer_posix_thread_param *param;
+  struct sigevent sev;
+  int err;
+
+  memset(&sev, 0, sizeof(struct sigevent));
+
+  data = (mrb_timer_posix_data *)mrb_malloc(mrb, sizeof(mrb_timer_posix_data));
+  memset(data, 0, sizeof(mrb_timer_posix_data));
+  data->metric_clock = -1;
+  data->id = mrb_timer_next_id();
+  data->clockid = opts->clockid;
+  data->slack_ns = opts->slack_ns;
+  data->shard = opts->shard;
+  data->thread_param.stats.clockid = opts->clockid;
+  mrb_timer_stats_reset(&data->thread_param.stats);
+  /* SIGALRM is timer_create's default */
+  data->timer_signo = opts->signo;
+
+#ifdef MRB_TIMER_HAVE_DISPATCHER
+  if (opts->worker && opts->has_thread && !opts->pooled) {
+    /* the kernel signals the worker itself, no helper thread in between */
+    sev.sigev_notify = SIGEV_THREAD_ID;
+    sev.sigev_notify_thread_id = opts->worker_tid;
+    sev.sigev_signo = opts->signo;
+    sev.sigev_value.sival_int = (int)data->id;
+  } else
+#endif
+  if (opts->has_thread || opts->pooled || opts->queued || opts->shard >= 0) {
+#ifdef SIGEV_THREAD
+    param = &data->thread_param;
+    param->thread_id = opts->thread_id;
+    param->has_thread = opts->has_thread;
+    param->signo = opts->signo;
+    param->queued = opts->queued;
+    param->worker = opts->worker;
+    param->id = data->id;
+    param->pooled = opts->pooled;
+    data->has_thread = 1;
+
+    sev.sigev_notify = SIGEV_THREAD;
+    sev.sigev_value.sival_ptr = (void *)param;
+    sev.sigev_notify_function = mrb_timer_posix_thread_func;
+    sev.sigev_signo = param->signo;
+
+#ifdef MRB_TIMER_HAVE_DISPATCHER
+    if (opts->dispatcher) {
+      pid_t tid;
+      int dsig;
+
+      if (mrb_timer_dispatcher_setup(opts->shard, &tid, &dsig) == -1) {
+        err = errno;
+        mrb_timer_posix_data_discard(mrb, data);
+        errno = err;
+        mrb_sys_fail(mrb, "dispatcher thread");
+      }
+      data->dispatch_handle = mrb_timer_dispatcher_register(opts->shard, param);
+      if (!data->dispatch_handle) {
+        mrb_timer_posix_data_discard(mrb, data);
+        mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot register timer to dispatcher");
+      }
+      sev.sigev_notify = SIGEV_THREAD_ID;
+      sev.sigev_notify_thread_id = tid;
+      sev.sigev_signo = dsig;
+      sev.sigev_value.sival_ptr = (void *)data->dispatch_handle;
     }
-    data->timer_ptr = timer_ptr;
-    data->timer_signo = SIGALRM; /* default */
+#endif
+#endif
+  } else if (!opts->signo) {
+    sev.sigev_notify = SIGEV_NONE;
   } else {
-    if (timer_create(clockid, &sev, timer_ptr) == -1) {
-      mrb_sys_fail(mrb, "timer_create failed");
-    }
-    data->timer_ptr = timer_ptr;
-    data->timer_signo = sev.sigev_signo;
+    sev.sigev_notify = SIGEV_SIGNAL;
+    sev.sigev_signo = opts->signo;
+    /* lets one handler tell the timers of a signal apart, see Timer.dispatch */
+    sev.sigev_value.sival_int = (int)data->id;
   }
-  data->clockid = clockid;
-  if (param) {
-    data->thread_param_ptr = param;
-  } else {
-    data->thread_param_ptr = NULL;
+
+  if (timer_create(opts->clockid, &sev, &data->timer) == -1) {
+    err = errno;
+    mrb_timer_posix_data_discard(mrb, data);
+    errno = err;
+    mrb_sys_fail(mrb, "timer_create failed");
+  }
+  if (opts->worker && mrb_timer_worker_attach(opts->worker, &data->worker_link, data->timer) == -1) {
+    timer_delete(data->timer);
+    mrb_timer_posix_data_discard(mrb, data);
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "worker thread has exited");
   }
 
-  DATA_PTR(self) = data;
+  data->metric_clock = mrb_timer_metric_clock(opts->clockid);
+  data->metric_notify = mrb_timer_posix_metric_notify(opts);
+  mrb_timer_metric_add(MRB_TIMER_METRIC_LIVE_POSIX, 1);
+  mrb_timer_metric_add((enum mrb_timer_metric)data->metric_clock, 1);
+  mrb_timer_metric_add((enum mrb_timer_metric)data->metric_notify, 1);
+
+  return data;
+}
+
+/* initialize */
+static mrb_value mrb_timer_posix_init(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_posix_data *data;
+  mrb_value options = mrb_nil_value();
+  struct mrb_timer_posix_options opts;
+
+  if (mrb_get_args(mrb, "|o", &options) == -1) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot get arguments");
+  }
+
+  /* Parse options as hash */
+  mrb_timer_posix_parse_options(mrb, options, &opts);
+
+  data = (mrb_timer_posix_data *)DATA_PTR(self);
+  if (data) {
+    mrb_timer_posix_free(mrb, data);
+  }
+
+  DATA_TYPE(self) = &mrb_timer_posix_data_type;
+  DATA_PTR(self) = NULL;
+
+  DATA_PTR(self) = mrb_timer_posix_create(mrb, &opts);
   return self;
 }
 
-static int mrb_set_itimerspec(mrb_int start, mrb_int start_nsec, mrb_int interval, mrb_int interval_nsec,
-                              struct itimerspec *ts)
+/* Timer::POSIX.create_many(n, options): n timers sharing one option set */
+static mrb_value mrb_timer_posix_create_many(mrb_state *mrb, mrb_value klass)
 {
-  if (start < 0 || interval < 0 || ts == NULL) {
-    errno = EINVAL;
-    return -1;
+  mrb_int n, i;
+  mrb_value options = mrb_nil_value(), ret;
+  struct mrb_timer_posix_options opts;
+  struct RData *obj;
+  int ai;
+
+  if (mrb_get_args(mrb, "i|o", &n, &options) == -1) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot get arguments");
+  }
+  if (n < 0) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "Count must be 0 or positive");
   }
 
-  ts->it_value.tv_sec = (time_t)start;
-  ts->it_value.tv_nsec = (long)start_nsec;
+  mrb_timer_posix_parse_options(mrb, options, &opts);
 
-  ts->it_interval.tv_sec = (time_t)interval;
-  ts->it_interval.tv_nsec = (long)interval_nsec;
+  ret = mrb_ary_new_capa(mrb, n);
+  ai = mrb_gc_arena_save(mrb);
+  for (i = 0; i < n; i++) {
+    obj = mrb_data_object_alloc(mrb, mrb_class_ptr(klass), NULL, &mrb_timer_posix_data_type);
+    obj->data = mrb_timer_posix_create(mrb, &opts);
+    mrb_ary_push(mrb, ret, mrb_obj_value(obj));
+    mrb_gc_arena_restore(mrb, ai);
+  }
 
-  return 0;
+  return ret;
 }
 
 static mrb_value mrb_timer_posix_start(mrb_state *mrb, mrb_value self)
 {
-  mrb_timer_posix_data *data = DATA_PTR(self);
-  mrb_int start, interval = -1;
-  mrb_int s_sec, s_nsec, i_sec = 0, i_nsec = 0;
-  struct itimerspec ts;
+  mrb_timer_posix_data *data = mrb_timer_posix_get(mrb, self);
+  mrb_int start, interval = 0;
 
   /* start and interval should be msec */
   if (mrb_get_args(mrb, "i|i", &start, &interval) == -1) {
     mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot get arguments");
   }
+  if (start < 0 || interval < 0) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "Values must be 0 or positive");
+  }
 
-  s_sec = (mrb_int)(start / 1000);
-  s_nsec = (start % 1000) * 1000000;
-
-  if (interval >= 0) {
-    i_sec = (mrb_int)(interval / 1000);
-    i_nsec = (interval % 1000) * 1000000;
+  if (mrb_timer_posix_settime(data, 0, (uint64_t)start * 1000000ULL, (uint64_t)interval * 1000000ULL) == -1) {
+    mrb_sys_fail(mrb, "timer_settime");
   }
 
-  if (mrb_set_itimerspec(s_sec, s_nsec, i_sec, i_nsec, &ts) == -1) {
+  return self;
+}
+
+/* Same as start, but start and interval are nsec */
+static mrb_value mrb_timer_posix_start_ns(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_posix_data *data = mrb_timer_posix_get(mrb, self);
+  mrb_int start, interval = 0;
+
+  if (mrb_get_args(mrb, "i|i", &start, &interval) == -1) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot get arguments");
+  }
+  if (start < 0 || interval < 0) {
     mrb_raise(mrb, E_ARGUMENT_ERROR, "Values must be 0 or positive");
   }
 
-  if (timer_settime(*(data->timer_ptr), 0, &ts, NULL) == -1) {
+  if (mrb_timer_posix_settime(data, 0, (uint64_t)start, (uint64_t)interval) == -1) {
     mrb_sys_fail(mrb, "timer_settime");
   }
 
   return self;
 }
 
-static mrb_value mrb_timer_posix_stop(mrb_state *mrb, mrb_value self)
+/* Arm with TIMER_ABSTIME: deadline is nsec on the timer's clock, interval is nsec */
+static mrb_value mrb_timer_posix_start_at(mrb_state *mrb, mrb_value self)
 {
-  mrb_timer_posix_data *data = DATA_PTR(self);
+  mrb_timer_posix_data *data = mrb_timer_posix_get(mrb, self);
+  mrb_int deadline, interval = 0;
+
+  if (mrb_get_args(mrb, "i|i", &deadline, &interval) == -1) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot get arguments");
+  }
+  /* a zero it_value would disarm the timer */
+  if (deadline <= 0 || interval < 0) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "Deadline must be positive and interval 0 or positive");
+  }
+
+  if (mrb_timer_posix_settime(data, TIMER_ABSTIME, (uint64_t)deadline, (uint64_t)interval) == -1) {
+    mrb_sys_fail(mrb, "timer_settime");
+  }
+
+  return self;
+}
+
+/* Arm at the next multiple of period past now, plus offset, then every period; all done by the kernel */
+static int mrb_timer_posix_arm_every(mrb_timer_posix_data *data, uint64_t period_ns, uint64_t offset_ns)
+{
+  uint64_t next = mrb_timer_align_next(mrb_timer_clock_ns(data->clockid), period_ns, offset_ns);
+
+  if (mrb_timer_posix_settime(data, TIMER_ABSTIME, next, period_ns) == -1) {
+    return -1;
+  }
+  data->every_ns = period_ns;
+  data->every_offset_ns = offset_ns;
+  return 0;
+}
+
+/*
+ * start_every(period_msec, offset_msec = 0): fires on the clock's own grid,
+ * e.g. start_every(60_000) on the :00 of every minute of CLOCK_REALTIME
+ */
+static mrb_value mrb_timer_posix_start_every(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_posix_data *data = mrb_timer_posix_get(mrb, self);
+  mrb_int period, offset = 0;
+
+  if (mrb_get_args(mrb, "i|i", &period, &offset) == -1) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot get arguments");
+  }
+  if (period <= 0 || offset < 0) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "Period must be positive and offset 0 or positive");
+  }
+  /* the slack rounding would move the deadlines off the grid */
+  if (data->slack_ns) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "start_every cannot be used on a timer with slack:");
+  }
+
+  if (mrb_timer_posix_arm_every(data, (uint64_t)period * 1000000ULL, (uint64_t)offset * 1000000ULL) == -1) {
+    mrb_sys_fail(mrb, "timer_settime");
+  }
+
+  return self;
+}
+
+/*
+ * POSIX timers are not told when the clock is set. A forward jump only
+ * merges expiries, but after a backward one the pending expiry is more
+ * than a period away; re-arm on the grid of the new time then. Returns
+ * true when it did.
+ */
+static mrb_value mrb_timer_posix_realign(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_posix_data *data = mrb_timer_posix_get(mrb, self);
   struct itimerspec ts;
-  if (mrb_set_itimerspec(0, 0, 0, 0, &ts) == -1) {
-    mrb_raise(mrb, E_ARGUMENT_ERROR, "Invalid value for stop");
+  uint64_t remaining;
+
+  if (!data->every_ns) {
+    return mrb_false_value();
   }
+  if (timer_gettime(data->timer, &ts) == -1) {
+    mrb_sys_fail(mrb, "timer_gettime");
+  }
+  remaining = (uint64_t)ts.it_value.tv_sec * MRB_TIMER_NSEC_PER_SEC + (uint64_t)ts.it_value.tv_nsec;
+  if (remaining <= data->every_ns) {
+    return mrb_false_value();
+  }
+  if (mrb_timer_posix_arm_every(data, data->every_ns, data->every_offset_ns) == -1) {
+    mrb_sys_fail(mrb, "timer_settime");
+  }
+  return mrb_true_value();
+}
 
-  if (timer_settime(*(data->timer_ptr), 0, &ts, NULL) == -1) {
+/* Period of start_every in msec, nil for any other arm */
+static mrb_value mrb_timer_posix_every(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_posix_data *data = mrb_timer_posix_get(mrb, self);
+  if (!data->every_ns) {
+    return mrb_nil_value();
+  }
+  return mrb_fixnum_value((mrb_int)(data->every_ns / 1000000ULL));
+}
+
+static mrb_value mrb_timer_posix_stop(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_posix_data *data = mrb_timer_posix_get(mrb, self);
+
+  if (mrb_timer_posix_settime(data, 0, 0, 0) == -1) {
     mrb_sys_fail(mrb, "timer_settime");
   }
 
   return self;
 }
 
+/* Delete the kernel timer now instead of at GC, a pooled timer is checked in */
+static mrb_value mrb_timer_posix_close(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_posix_data *data = mrb_timer_posix_get(mrb, self);
+
+  DATA_PTR(self) = NULL;
+  mrb_timer_posix_free(mrb, data);
+
+  return mrb_nil_value();
+}
+
+static mrb_value mrb_timer_posix_is_closed(mrb_state *mrb, mrb_value self)
+{
+  return mrb_bool_value(DATA_PTR(self) == NULL);
+}
+
+#ifdef MRB_TIMER_HAVE_DISPATCHER
+static mrb_value mrb_timer_posix_set_dispatcher(mrb_state *mrb, mrb_value self)
+{
+  mrb_bool use;
+
+  if (mrb_get_args(mrb, "b", &use) == -1) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot get arguments");
+  }
+  mrb_timer_posix_use_dispatcher = use;
+  return mrb_bool_value(use);
+}
+
+static mrb_value mrb_timer_posix_get_dispatcher(mrb_state *mrb, mrb_value self)
+{
+  return mrb_bool_value(mrb_timer_posix_use_dispatcher);
+}
+
+static mrb_value mrb_timer_posix_is_dispatched(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_posix_data *data = mrb_timer_posix_get(mrb, self);
+  return mrb_bool_value(data->dispatch_handle != 0);
+}
+
+/* Dispatcher shard, nil for the default dispatcher or none */
+static mrb_value mrb_timer_posix_shard(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_posix_data *data = mrb_timer_posix_get(mrb, self);
+  if (!data->dispatch_handle || data->shard < 0) {
+    return mrb_nil_value();
+  }
+  return mrb_fixnum_value(data->shard);
+}
+#endif
+
+/*
+ * Timer.start_all(timers, start_msec, interval_msec = 0) arms every timer the same way,
+ * Timer.start_all(timers, [[start_msec, interval_msec], start_msec, ...]) one pair per timer.
+ */
+static mrb_value mrb_timer_start_all(mrb_state *mrb, mrb_value self)
+{
+  mrb_value timers, spec, pair;
+  mrb_int interval = 0, start = 0, i, len;
+  mrb_timer_posix_data *data;
+  int uniform;
+
+  if (mrb_get_args(mrb, "Ao|i", &timers, &spec, &interval) == -1) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot get arguments");
+  }
+
+  len = RARRAY_LEN(timers);
+  uniform = !mrb_array_p(spec);
+  if (uniform) {
+    start = mrb_fixnum(mrb_to_int(mrb, spec));
+  } else if (RARRAY_LEN(spec) != len) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "Pairs must be as many as timers");
+  }
+
+  for (i = 0; i < len; i++) {
+    data = (mrb_timer_posix_data *)mrb_data_get_ptr(mrb, mrb_ary_ref(mrb, timers, i), &mrb_timer_posix_data_type);
+    if (!uniform) {
+      pair = mrb_ary_ref(mrb, spec, i);
+      if (mrb_array_p(pair)) {
+        start = mrb_fixnum(mrb_to_int(mrb, mrb_ary_ref(mrb, pair, 0)));
+        interval = RARRAY_LEN(pair) > 1 ? mrb_fixnum(mrb_to_int(mrb, mrb_ary_ref(mrb, pair, 1))) : 0;
+      } else {
+        start = mrb_fixnum(mrb_to_int(mrb, pair));
+        interval = 0;
+      }
+    }
+    if (start < 0 || interval < 0) {
+      mrb_raise(mrb, E_ARGUMENT_ERROR, "Values must be 0 or positive");
+    }
+    if (!data) {
+      mrb_raise(mrb, E_ARGUMENT_ERROR, "Uninitialized timer");
+    }
+    if (mrb_timer_posix_settime(data, 0, (uint64_t)start * 1000000ULL, (uint64_t)interval * 1000000ULL) == -1) {
+      mrb_sys_fail(mrb, "timer_settime");
+    }
+  }
+
+  return timers;
+}
+
+/*
+ * Timer.snapshot(timers) dumps the armed timers of the Array to a String:
+ * a header, then one fixed size record per timer with its clock, signal,
+ * absolute next expiry, interval, slack and start_every schedule. The layout is native, for a
+ * process restarting on the same host. Timer.restore(dump, options)
+ * creates and arms them all again.
+ *
+ * CPU time clocks belong to the old process and are left out.
+ */
+#define MRB_TIMER_SNAPSHOT_MAGIC "MRTS"
+#define MRB_TIMER_SNAPSHOT_VERSION 2
+#define MRB_TIMER_SNAPSHOT_QUEUED 1
+
+struct mrb_timer_snapshot_header {
+  char magic[4];
+  uint32_t version;
+  uint32_t count;
+  uint32_t record_size;
+};
+
+struct mrb_timer_snapshot_record {
+  int32_t clockid;
+  int32_t signo; /* 0 for signal: nil */
+  uint32_t flags;
+  uint32_t reserved;
+  uint64_t deadline_ns; /* absolute on clockid */
+  uint64_t interval_ns;
+  uint64_t slack_ns;
+  uint64_t every_ns; /* 0 unless armed by start_every */
+  uint64_t every_offset_ns;
+};
+
+static mrb_value mrb_timer_snapshot(mrb_state *mrb, mrb_value self)
+{
+  mrb_value timers, ret;
+  mrb_timer_posix_data *data;
+  struct mrb_timer_snapshot_header head;
+  struct mrb_timer_snapshot_record rec;
+  struct itimerspec ts;
+  mrb_int i, len;
+
+  if (mrb_get_args(mrb, "A", &timers) == -1) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot get arguments");
+  }
+
+  len = RARRAY_LEN(timers);
+  memset(&head, 0, sizeof(head));
+  memcpy(head.magic, MRB_TIMER_SNAPSHOT_MAGIC, 4);
+  head.version = MRB_TIMER_SNAPSHOT_VERSION;
+  head.record_size = sizeof(rec);
+  ret = mrb_str_buf_new(mrb, sizeof(head) + sizeof(rec) * len);
+  mrb_str_cat(mrb, ret, (const char *)&head, sizeof(head));
+
+  for (i = 0; i < len; i++) {
+    data = (mrb_timer_posix_data *)mrb_data_get_ptr(mrb, mrb_ary_ref(mrb, timers, i), &mrb_timer_posix_data_type);
+    if (!data) {
+      continue;
+    }
+    if ((clockid_t)data->clockid < 0 || data->clockid == CLOCK_PROCESS_CPUTIME_ID ||
+        data->clockid == CLOCK_THREAD_CPUTIME_ID) {
+      continue;
+    }
+    if (timer_gettime(data->timer, &ts) == -1) {
+      mrb_sys_fail(mrb, "timer_gettime");
+    }
+    if (!ts.it_value.tv_sec && !ts.it_value.tv_nsec) {
+      continue;
+    }
+
+    memset(&rec, 0, sizeof(rec));
+    rec.clockid = (int32_t)data->clockid;
+    rec.signo = data->timer_signo;
+    if (data->has_thread && data->thread_param.queued) {
+      rec.flags |= MRB_TIMER_SNAPSHOT_QUEUED;
+      rec.signo = 0;
+    }
+    rec.deadline_ns = mrb_timer_clock_ns(data->clockid) + (uint64_t)ts.it_value.tv_sec * MRB_TIMER_NSEC_PER_SEC +
+                      (uint64_t)ts.it_value.tv_nsec;
+    rec.interval_ns = (uint64_t)ts.it_interval.tv_sec * MRB_TIMER_NSEC_PER_SEC + (uint64_t)ts.it_interval.tv_nsec;
+    rec.slack_ns = data->slack_ns;
+    rec.every_ns = data->every_ns;
+    rec.every_offset_ns = data->every_offset_ns;
+    mrb_str_cat(mrb, ret, (const char *)&rec, sizeof(rec));
+    head.count++;
+  }
+
+  memcpy(RSTRING_PTR(ret), &head, sizeof(head));
+  return ret;
+}
+
+/*
+ * Timer.restore(dump, options = nil) => [Timer::POSIX, ...] armed as dumped.
+ * options are those of Timer::POSIX.new (thread_id:, dispatcher:, ...);
+ * the clock and the slack come from the dump, and so does the signal unless
+ * options set signal: or queue:. Deadlines already past expire at once.
+ */
+static mrb_value mrb_timer_restore(mrb_state *mrb, mrb_value self)
+{
+  mrb_value dump, options = mrb_nil_value(), ret, obj;
+  struct mrb_timer_posix_options base, opts;
+  struct mrb_timer_snapshot_header head;
+  struct mrb_timer_snapshot_record rec;
+  struct RClass *posix;
+  const char *p;
+  uint32_t i;
+  int ai;
+
+  if (mrb_get_args(mrb, "S|o", &dump, &options) == -1) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot get arguments");
+  }
+  if ((size_t)RSTRING_LEN(dump) < sizeof(head)) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "Timer snapshot too short");
+  }
+  memcpy(&head, RSTRING_PTR(dump), sizeof(head));
+  if (memcmp(head.magic, MRB_TIMER_SNAPSHOT_MAGIC, 4) != 0 || head.version != MRB_TIMER_SNAPSHOT_VERSION ||
+      head.record_size != sizeof(rec)) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "Not a timer snapshot");
+  }
+  if ((size_t)RSTRING_LEN(dump) != sizeof(head) + (size_t)head.count * sizeof(rec)) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "Timer snapshot truncated");
+  }
+
+  mrb_timer_posix_parse_options(mrb, options, &base);
+  posix = mrb_class_get_under(mrb, mrb_module_get(mrb, "Timer"), "POSIX");
+  ret = mrb_ary_new_capa(mrb, (mrb_int)head.count);
+  ai = mrb_gc_arena_save(mrb);
+  p = RSTRING_PTR(dump) + sizeof(head);
+  for (i = 0; i < head.count; i++, p += sizeof(rec)) {
+    memcpy(&rec, p, sizeof(rec));
+    opts = base;
+    opts.clockid = (clockid_t)rec.clockid;
+    opts.slack_ns = rec.slack_ns;
+    if (!base.has_signo) {
+      opts.has_signo = 1;
+      opts.signo = rec.signo;
+      if (rec.flags & MRB_TIMER_SNAPSHOT_QUEUED) {
+#ifdef MRB_TIMER_HAVE_DISPATCHER
+        opts.queued = 1;
+        opts.dispatcher = 1;
+        opts.has_thread = 0;
+#endif
+        opts.signo = 0;
+      }
+    }
+
+    obj = mrb_obj_value(mrb_data_object_alloc(mrb, posix, NULL, &mrb_timer_posix_data_type));
+    DATA_PTR(obj) = mrb_timer_posix_create(mrb, &opts);
+    if (rec.every_ns) {
+      /* back on the grid of the current time, expiries missed meanwhile are not replayed */
+      if (mrb_timer_posix_arm_every((mrb_timer_posix_data *)DATA_PTR(obj), rec.every_ns, rec.every_offset_ns) == -1) {
+        mrb_sys_fail(mrb, "timer_settime");
+      }
+    } else if (mrb_timer_posix_settime((mrb_timer_posix_data *)DATA_PTR(obj), TIMER_ABSTIME,
+                                       rec.deadline_ns ? rec.deadline_ns : 1, rec.interval_ns) == -1) {
+      /* a zero it_value would disarm, the deadline is at least 1 */
+      mrb_sys_fail(mrb, "timer_settime");
+    }
+    mrb_ary_push(mrb, ret, obj);
+    mrb_gc_arena_restore(mrb, ai);
+  }
+
+  return ret;
+}
+
+/* Current time of the timer's clock in nsec, to compute deadlines for start_at */
+static mrb_value mrb_timer_posix_now_ns(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_posix_data *data = mrb_timer_posix_get(mrb, self);
+  return mrb_fixnum_value((mrb_int)mrb_timer_clock_ns(data->clockid));
+}
+
+static mrb_value mrb_timer_clock_gettime_ns(mrb_state *mrb, mrb_value self)
+{
+  mrb_int clockid = CLOCK_MONOTONIC;
+  struct timespec ts;
+
+  if (mrb_get_args(mrb, "|i", &clockid) == -1) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot get arguments");
+  }
+  if (clock_gettime((clockid_t)clockid, &ts) == -1) {
+    mrb_sys_fail(mrb, "clock_gettime");
+  }
+  return mrb_fixnum_value((mrb_int)ts.tv_sec * (mrb_int)MRB_TIMER_NSEC_PER_SEC + (mrb_int)ts.tv_nsec);
+}
+
+/* Overrun count of the last delivered expiration, as timer_getoverrun(2) */
+static mrb_value mrb_timer_posix_overrun(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_posix_data *data = mrb_timer_posix_get(mrb, self);
+  int overrun = timer_getoverrun(data->timer);
+
+  if (overrun == -1) {
+    mrb_sys_fail(mrb, "timer_getoverrun");
+  }
+  return mrb_fixnum_value(overrun);
+}
+
+/* Number of expirations since the last call, 0 if none */
+static mrb_value mrb_timer_posix_read_expirations(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_posix_data *data = mrb_timer_posix_get(mrb, self);
+  uint64_t total, count;
+
+  total = data->expired_base + mrb_timer_posix_expired(data, mrb_timer_clock_ns(data->clockid));
+  count = total - data->expired_read;
+  data->expired_read = total;
+
+  return mrb_fixnum_value((mrb_int)count);
+}
+
 static mrb_value mrb_timer_posix_status_raw(mrb_state *mrb, mrb_value self)
 {
-  mrb_timer_posix_data *data = DATA_PTR(self);
+  mrb_timer_posix_data *data = mrb_timer_posix_get(mrb, self);
   struct itimerspec ts;
   mrb_value ret;
 
-  if (timer_gettime(*(data->timer_ptr), &ts) == -1) {
+  if (timer_gettime(data->timer, &ts) == -1) {
     mrb_sys_fail(mrb, "timer_gettime");
   }
 
@@ -450,20 +1301,76 @@ static mrb_value mrb_timer_posix_status_raw(mrb_state *mrb, mrb_value self)
   return ret;
 }
 
+/* Allocation free status queries, prefer these to __status_raw */
+static mrb_value mrb_timer_posix_remaining_ns(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_posix_data *data = mrb_timer_posix_get(mrb, self);
+  struct itimerspec ts;
+
+  if (timer_gettime(data->timer, &ts) == -1) {
+    mrb_sys_fail(mrb, "timer_gettime");
+  }
+  return mrb_fixnum_value((mrb_int)ts.it_value.tv_sec * (mrb_int)MRB_TIMER_NSEC_PER_SEC + (mrb_int)ts.it_value.tv_nsec);
+}
+
+static mrb_value mrb_timer_posix_interval_ns(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_posix_data *data = mrb_timer_posix_get(mrb, self);
+  struct itimerspec ts;
+
+  if (timer_gettime(data->timer, &ts) == -1) {
+    mrb_sys_fail(mrb, "timer_gettime");
+  }
+  return mrb_fixnum_value((mrb_int)ts.it_interval.tv_sec * (mrb_int)MRB_TIMER_NSEC_PER_SEC +
+                          (mrb_int)ts.it_interval.tv_nsec);
+}
+
+static mrb_value mrb_timer_posix_is_interval(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_posix_data *data = mrb_timer_posix_get(mrb, self);
+  struct itimerspec ts;
+
+  if (timer_gettime(data->timer, &ts) == -1) {
+    mrb_sys_fail(mrb, "timer_gettime");
+  }
+  return mrb_bool_value(ts.it_interval.tv_sec || ts.it_interval.tv_nsec);
+}
+
+static mrb_value mrb_timer_posix_is_stopped(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_posix_data *data = mrb_timer_posix_get(mrb, self);
+  struct itimerspec ts;
+
+  if (timer_gettime(data->timer, &ts) == -1) {
+    mrb_sys_fail(mrb, "timer_gettime");
+  }
+  return mrb_bool_value(!ts.it_value.tv_sec && !ts.it_value.tv_nsec);
+}
+
 static mrb_value mrb_timer_posix_is_running(mrb_state *mrb, mrb_value self)
 {
-  mrb_timer_posix_data *data = DATA_PTR(self);
+  mrb_timer_posix_data *data = mrb_timer_posix_get(mrb, self);
   struct itimerspec ts;
 
-  if (timer_gettime(*(data->timer_ptr), &ts) == -1) {
+  if (timer_gettime(data->timer, &ts) == -1) {
     mrb_sys_fail(mrb, "timer_gettime");
   }
   return mrb_bool_value(ts.it_value.tv_sec || ts.it_value.tv_nsec);
 }
 
+/* Timer.worker handle given as worker:, nil for none */
+static mrb_value mrb_timer_posix_worker(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_posix_data *data = mrb_timer_posix_get(mrb, self);
+  if (!data->worker_link.handle) {
+    return mrb_nil_value();
+  }
+  return mrb_fixnum_value((mrb_int)data->worker_link.handle);
+}
+
 static mrb_value mrb_timer_posix_signo(mrb_state *mrb, mrb_value self)
 {
-  mrb_timer_posix_data *data = DATA_PTR(self);
+  mrb_timer_posix_data *data = mrb_timer_posix_get(mrb, self);
   int signo = data->timer_signo;
   if (signo > 0) {
     return mrb_fixnum_value(data->timer_signo);
@@ -472,32 +1379,405 @@ static mrb_value mrb_timer_posix_signo(mrb_state *mrb, mrb_value self)
   }
 }
 
+static mrb_value mrb_timer_posix_slack(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_posix_data *data = mrb_timer_posix_get(mrb, self);
+  return mrb_fixnum_value((mrb_int)(data->slack_ns / 1000000ULL));
+}
+
+/*
+ * Lateness of the expiries against their schedule, recorded by the SIGEV_THREAD
+ * function or the dispatcher. A signal: timer is notified by the kernel alone,
+ * its handler calls mark_fired instead.
+ */
+static mrb_value mrb_timer_posix_stats(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_posix_data *data = mrb_timer_posix_get(mrb, self);
+  return mrb_timer_stats_to_hash(mrb, &data->thread_param.stats);
+}
+
+static mrb_value mrb_timer_posix_reset_stats(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_posix_data *data = mrb_timer_posix_get(mrb, self);
+  mrb_timer_stats_reset(&data->thread_param.stats);
+  return self;
+}
+
+static mrb_value mrb_timer_posix_mark_fired(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_posix_data *data = mrb_timer_posix_get(mrb, self);
+  mrb_timer_stats_record_now(&data->thread_param.stats);
+  return self;
+}
+
+/* Identifies the timer in Timer.drain_events */
+static mrb_value mrb_timer_posix_id(mrb_state *mrb, mrb_value self)
+{
+  mrb_timer_posix_data *data = mrb_timer_posix_get(mrb, self);
+  return mrb_fixnum_value((mrb_int)data->id);
+}
+
 static mrb_value mrb_timer_posix_clockid(mrb_state *mrb, mrb_value self)
 {
-  mrb_timer_posix_data *data = DATA_PTR(self);
+  mrb_timer_posix_data *data = mrb_timer_posix_get(mrb, self);
   return mrb_fixnum_value((int)data->clockid);
 }
 
+/*
+ * Timer::Pool hands out pre-created kernel timers, so that per-request
+ * deadlines need neither timer_create nor timer_delete. Pooled timers are
+ * always notified through their thread param, which checkout re-points to
+ * the requested signal and thread in place.
+ *
+ * The pool is shared by its Ruby object and every checked out timer, and
+ * freed by whichever goes last.
+ */
+struct mrb_timer_pool {
+  int refs;
+  int closed;
+  struct mrb_timer_posix_options opts;
+  mrb_timer_posix_data **idle;
+  mrb_int idle_len;
+  mrb_int idle_capa;
+};
+
+static void mrb_timer_pool_unref(mrb_state *mrb, struct mrb_timer_pool *pool)
+{
+  if (--pool->refs == 0) {
+    mrb_free(mrb, pool->idle);
+    mrb_free(mrb, pool);
+  }
+}
+
+static void mrb_timer_pool_close_idle(mrb_state *mrb, struct mrb_timer_pool *pool)
+{
+  mrb_int i;
+
+  pool->closed = 1;
+  for (i = 0; i < pool->idle_len; i++) {
+    timer_delete(pool->idle[i]->timer);
+    mrb_timer_posix_data_discard(mrb, pool->idle[i]);
+  }
+  pool->idle_len = 0;
+}
+
+/* Disarm a checked out timer and keep it for the next checkout */
+/*
+ * The dispatcher reads the thread_param of a pending signal under its lock,
+ * and the SIGEV_THREAD helper of a pooled timer under the pool params lock,
+ * so a recycled timer gets its new target under the same lock: a signal of
+ * the previous user sees either the old target or the new one, never a mix
+ * of both.
+ */
+static void mrb_timer_pool_param_lock(mrb_timer_posix_data *data)
+{
+#ifdef MRB_TIMER_HAVE_DISPATCHER
+  if (data->dispatch_handle) {
+    mrb_timer_dispatcher_lock(data->shard);
+    return;
+  }
+#endif
+  pthread_mutex_lock(&mrb_timer_pool_params_lock);
+}
+
+static void mrb_timer_pool_param_unlock(mrb_timer_posix_data *data)
+{
+#ifdef MRB_TIMER_HAVE_DISPATCHER
+  if (data->dispatch_handle) {
+    mrb_timer_dispatcher_unlock(data->shard);
+    return;
+  }
+#endif
+  pthread_mutex_unlock(&mrb_timer_pool_params_lock);
+}
+
+/* Move a pooled timer to the live notification bucket of its new target */
+static void mrb_timer_pool_set_notify(mrb_timer_posix_data *data, const struct mrb_timer_posix_options *opts)
+{
+  int notify = mrb_timer_posix_metric_notify(opts);
+
+  if (notify != data->metric_notify) {
+    mrb_timer_metric_add((enum mrb_timer_metric)data->metric_notify, -1);
+    mrb_timer_metric_add((enum mrb_timer_metric)notify, 1);
+    data->metric_notify = notify;
+  }
+}
+
+static void mrb_timer_pool_release(mrb_state *mrb, mrb_timer_posix_data *data)
+{
+  struct mrb_timer_pool *pool = data->pool;
+
+  mrb_timer_posix_settime(data, 0, 0, 0);
+  mrb_timer_worker_detach(&data->worker_link);
+  /* signals still queued for the previous user are dropped */
+  mrb_timer_pool_param_lock(data);
+  data->thread_param.signo = 0;
+  data->thread_param.queued = 0;
+  data->thread_param.worker = 0;
+  mrb_timer_pool_param_unlock(data);
+  data->worker_link.handle = 0;
+  mrb_timer_pool_set_notify(data, &pool->opts);
+
+  if (pool->closed) {
+    data->pool = NULL;
+    timer_delete(data->timer);
+    mrb_timer_posix_data_discard(mrb, data);
+  } else {
+    if (pool->idle_len == pool->idle_capa) {
+      mrb_int capa = pool->idle_capa ? pool->idle_capa * 2 : 8;
+      pool->idle = (mrb_timer_posix_data **)mrb_realloc(mrb, pool->idle, sizeof(mrb_timer_posix_data *) * capa);
+      pool->idle_capa = capa;
+    }
+    pool->idle[pool->idle_len++] = data;
+  }
+  mrb_timer_pool_unref(mrb, pool);
+}
+
+static void mrb_timer_pool_free(mrb_state *mrb, void *p)
+{
+  struct mrb_timer_pool *pool = (struct mrb_timer_pool *)p;
+  if (!pool) {
+    return;
+  }
+  mrb_timer_pool_close_idle(mrb, pool);
+  mrb_timer_pool_unref(mrb, pool);
+}
+
+static const struct mrb_data_type mrb_timer_pool_data_type = {"mrb_timer_pool", mrb_timer_pool_free};
+
+/* NULL for Timer::Pool.allocate or after initialize raised */
+static struct mrb_timer_pool *mrb_timer_pool_data(mrb_state *mrb, mrb_value self)
+{
+  struct mrb_timer_pool *pool = DATA_PTR(self);
+  if (!pool) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Timer pool not initialized");
+  }
+  return pool;
+}
+
+static struct mrb_timer_pool *mrb_timer_pool_get(mrb_state *mrb, mrb_value self)
+{
+  struct mrb_timer_pool *pool = mrb_timer_pool_data(mrb, self);
+  if (pool->closed) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Timer pool already closed");
+  }
+  return pool;
+}
+
+/* initialize(size, clock_id: ..., dispatcher: ...) */
+static mrb_value mrb_timer_pool_init(mrb_state *mrb, mrb_value self)
+{
+  struct mrb_timer_pool *pool;
+  mrb_value options = mrb_nil_value();
+  mrb_int size, i;
+
+  if (mrb_get_args(mrb, "i|o", &size, &options) == -1) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot get arguments");
+  }
+  if (size < 0) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "Size must be 0 or positive");
+  }
+
+  pool = (struct mrb_timer_pool *)DATA_PTR(self);
+  if (pool) {
+    mrb_timer_pool_free(mrb, pool);
+  }
+  DATA_TYPE(self) = &mrb_timer_pool_data_type;
+  DATA_PTR(self) = NULL;
+
+  pool = (struct mrb_timer_pool *)mrb_malloc(mrb, sizeof(struct mrb_timer_pool));
+  memset(pool, 0, sizeof(struct mrb_timer_pool));
+  pool->refs = 1;
+  mrb_timer_posix_parse_options(mrb, options, &pool->opts);
+  pool->opts.signo = 0;
+  pool->opts.has_thread = 0;
+  pool->opts.worker = 0;
+  pool->opts.pooled = 1;
+  DATA_PTR(self) = pool;
+
+  pool->idle = (mrb_timer_posix_data **)mrb_malloc(mrb, sizeof(mrb_timer_posix_data *) * (size ? size : 1));
+  pool->idle_capa = size ? size : 1;
+  for (i = 0; i < size; i++) {
+    pool->idle[pool->idle_len++] = mrb_timer_posix_create(mrb, &pool->opts);
+  }
+
+  return self;
+}
+
+/* checkout(signal: ..., thread_id: ...), a new kernel timer is made only when the pool is empty */
+static mrb_value mrb_timer_pool_checkout(mrb_state *mrb, mrb_value self)
+{
+  struct mrb_timer_pool *pool = mrb_timer_pool_get(mrb, self);
+  struct RClass *posix = mrb_class_get_under(mrb, mrb_module_get(mrb, "Timer"), "POSIX");
+  mrb_value options = mrb_nil_value();
+  struct mrb_timer_posix_options opts;
+  mrb_timer_posix_data *data;
+  struct RData *obj;
+
+  if (mrb_get_args(mrb, "|o", &options) == -1) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot get arguments");
+  }
+  mrb_timer_posix_parse_options(mrb, options, &opts);
+
+  obj = mrb_data_object_alloc(mrb, posix, NULL, &mrb_timer_posix_data_type);
+  if (pool->idle_len) {
+    data = pool->idle[--pool->idle_len];
+  } else {
+    data = mrb_timer_posix_create(mrb, &pool->opts);
+  }
+
+  /* a fresh identity, so that stale events of the previous user are told apart */
+  data->id = mrb_timer_next_id();
+  mrb_timer_pool_param_lock(data);
+  data->thread_param.thread_id = opts.thread_id;
+  data->thread_param.has_thread = opts.has_thread;
+  data->thread_param.signo = opts.signo;
+  data->thread_param.queued = opts.queued;
+  data->thread_param.worker = opts.worker;
+  data->thread_param.id = data->id;
+  mrb_timer_stats_reset(&data->thread_param.stats);
+  mrb_timer_pool_param_unlock(data);
+  mrb_timer_pool_set_notify(data, &opts);
+  data->timer_signo = opts.signo;
+  data->slack_ns = opts.slack_ns ? opts.slack_ns : pool->opts.slack_ns;
+  data->first_ns = 0;
+  data->interval_ns = 0;
+  data->expired_base = 0;
+  data->expired_read = 0;
+  data->pool = pool;
+  pool->refs++;
+  if (opts.worker && mrb_timer_worker_attach(opts.worker, &data->worker_link, data->timer) == -1) {
+    /* the worker exited since the options were parsed, the timer goes back to the pool */
+    mrb_timer_pool_release(mrb, data);
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "worker thread has exited");
+  }
+
+  obj->data = data;
+  return mrb_obj_value(obj);
+}
+
+static mrb_value mrb_timer_pool_checkin(mrb_state *mrb, mrb_value self)
+{
+  struct mrb_timer_pool *pool = mrb_timer_pool_data(mrb, self);
+  mrb_value timer;
+  mrb_timer_posix_data *data;
+
+  if (mrb_get_args(mrb, "o", &timer) == -1) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot get arguments");
+  }
+  data = (mrb_timer_posix_data *)mrb_data_get_ptr(mrb, timer, &mrb_timer_posix_data_type);
+  if (!data) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Timer already closed");
+  }
+  if (data->pool != pool) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "Timer does not belong to this pool");
+  }
+
+  DATA_PTR(timer) = NULL;
+  mrb_timer_pool_release(mrb, data);
+
+  return mrb_nil_value();
+}
+
+static mrb_value mrb_timer_pool_available(mrb_state *mrb, mrb_value self)
+{
+  struct mrb_timer_pool *pool = mrb_timer_pool_data(mrb, self);
+  return mrb_fixnum_value(pool->idle_len);
+}
+
+/* Delete idle kernel timers now, checked out ones are deleted on checkin */
+static mrb_value mrb_timer_pool_close(mrb_state *mrb, mrb_value self)
+{
+  struct mrb_timer_pool *pool = mrb_timer_pool_get(mrb, self);
+  mrb_timer_pool_close_idle(mrb, pool);
+  return mrb_nil_value();
+}
+
+static mrb_value mrb_timer_pool_is_closed(mrb_state *mrb, mrb_value self)
+{
+  struct mrb_timer_pool *pool = mrb_timer_pool_data(mrb, self);
+  return mrb_bool_value(pool->closed);
+}
+
 #define EXPORT_CLOCK_CONST(name) mrb_define_const(mrb, timer, #name, mrb_fixnum_value(name))
 
 void mrb_mruby_timer_thread_gem_init(mrb_state *mrb)
 {
-  struct RClass *rtsignal, *timer, *posix;
+  struct RClass *rtsignal, *timer, *posix, *pool;
+  mrb_timer_build_signo_table(mrb);
   rtsignal = mrb_define_module(mrb, "RTSignal");
   mrb_define_module_function(mrb, rtsignal, "get", mrb_rtsignal_get, MRB_ARGS_REQ(1));
 
   timer = mrb_define_module(mrb, "Timer");
+  mrb_define_module_function(mrb, timer, "clock_gettime_ns", mrb_timer_clock_gettime_ns, MRB_ARGS_OPT(1));
+  mrb_define_module_function(mrb, timer, "start_all", mrb_timer_start_all, MRB_ARGS_ARG(2, 1));
+  mrb_define_module_function(mrb, timer, "snapshot", mrb_timer_snapshot, MRB_ARGS_REQ(1));
+  mrb_define_module_function(mrb, timer, "restore", mrb_timer_restore, MRB_ARGS_ARG(1, 1));
 
   posix = mrb_define_class_under(mrb, timer, "POSIX", mrb->object_class);
   MRB_SET_INSTANCE_TT(posix, MRB_TT_DATA);
   mrb_define_method(mrb, posix, "initialize", mrb_timer_posix_init, MRB_ARGS_ARG(0, 1));
+  mrb_define_class_method(mrb, posix, "create_many", mrb_timer_posix_create_many, MRB_ARGS_ARG(1, 1));
   mrb_define_method(mrb, posix, "start", mrb_timer_posix_start, MRB_ARGS_ARG(1, 1));
+  mrb_define_method(mrb, posix, "start_ns", mrb_timer_posix_start_ns, MRB_ARGS_ARG(1, 1));
+  mrb_define_method(mrb, posix, "start_at", mrb_timer_posix_start_at, MRB_ARGS_ARG(1, 1));
+  mrb_define_method(mrb, posix, "start_every", mrb_timer_posix_start_every, MRB_ARGS_ARG(1, 1));
+  mrb_define_method(mrb, posix, "realign", mrb_timer_posix_realign, MRB_ARGS_NONE());
+  mrb_define_method(mrb, posix, "every", mrb_timer_posix_every, MRB_ARGS_NONE());
+  mrb_define_method(mrb, posix, "now_ns", mrb_timer_posix_now_ns, MRB_ARGS_NONE());
   mrb_define_method(mrb, posix, "stop", mrb_timer_posix_stop, MRB_ARGS_NONE());
   mrb_define_method(mrb, posix, "__status_raw", mrb_timer_posix_status_raw, MRB_ARGS_NONE());
   mrb_define_method(mrb, posix, "running?", mrb_timer_posix_is_running, MRB_ARGS_NONE());
+  mrb_define_method(mrb, posix, "stopped?", mrb_timer_posix_is_stopped, MRB_ARGS_NONE());
+  mrb_define_method(mrb, posix, "interval?", mrb_timer_posix_is_interval, MRB_ARGS_NONE());
+  mrb_define_method(mrb, posix, "remaining_ns", mrb_timer_posix_remaining_ns, MRB_ARGS_NONE());
+  mrb_define_method(mrb, posix, "interval_ns", mrb_timer_posix_interval_ns, MRB_ARGS_NONE());
+  mrb_define_method(mrb, posix, "overrun", mrb_timer_posix_overrun, MRB_ARGS_NONE());
+  mrb_define_method(mrb, posix, "read_expirations", mrb_timer_posix_read_expirations, MRB_ARGS_NONE());
 
   mrb_define_method(mrb, posix, "signo", mrb_timer_posix_signo, MRB_ARGS_NONE());
+  mrb_define_method(mrb, posix, "worker", mrb_timer_posix_worker, MRB_ARGS_NONE());
   mrb_define_method(mrb, posix, "clock_id", mrb_timer_posix_clockid, MRB_ARGS_NONE());
+  mrb_define_method(mrb, posix, "id", mrb_timer_posix_id, MRB_ARGS_NONE());
+  mrb_define_method(mrb, posix, "slack", mrb_timer_posix_slack, MRB_ARGS_NONE());
+  mrb_define_method(mrb, posix, "stats", mrb_timer_posix_stats, MRB_ARGS_NONE());
+  mrb_define_method(mrb, posix, "reset_stats", mrb_timer_posix_reset_stats, MRB_ARGS_NONE());
+  mrb_define_method(mrb, posix, "mark_fired", mrb_timer_posix_mark_fired, MRB_ARGS_NONE());
+  mrb_define_method(mrb, posix, "close", mrb_timer_posix_close, MRB_ARGS_NONE());
+  mrb_define_method(mrb, posix, "closed?", mrb_timer_posix_is_closed, MRB_ARGS_NONE());
+#ifdef MRB_TIMER_HAVE_DISPATCHER
+  mrb_define_class_method(mrb, posix, "dispatcher=", mrb_timer_posix_set_dispatcher, MRB_ARGS_REQ(1));
+  mrb_define_class_method(mrb, posix, "dispatcher?", mrb_timer_posix_get_dispatcher, MRB_ARGS_NONE());
+  mrb_define_const(mrb, timer, "DISPATCHER_SIGNAL", mrb_fixnum_value(MRB_TIMER_DISPATCHER_SIGNAL));
+  mrb_define_method(mrb, posix, "dispatched?", mrb_timer_posix_is_dispatched, MRB_ARGS_NONE());
+  mrb_define_method(mrb, posix, "shard", mrb_timer_posix_shard, MRB_ARGS_NONE());
+#endif
+
+  pool = mrb_define_class_under(mrb, timer, "Pool", mrb->object_class);
+  MRB_SET_INSTANCE_TT(pool, MRB_TT_DATA);
+  mrb_define_method(mrb, pool, "initialize", mrb_timer_pool_init, MRB_ARGS_ARG(1, 1));
+  mrb_define_method(mrb, pool, "checkout", mrb_timer_pool_checkout, MRB_ARGS_ARG(0, 1));
+  mrb_define_method(mrb, pool, "checkin", mrb_timer_pool_checkin, MRB_ARGS_REQ(1));
+  mrb_define_method(mrb, pool, "available", mrb_timer_pool_available, MRB_ARGS_NONE());
+  mrb_define_method(mrb, pool, "close", mrb_timer_pool_close, MRB_ARGS_NONE());
+  mrb_define_method(mrb, pool, "closed?", mrb_timer_pool_is_closed, MRB_ARGS_NONE());
+
+  mrb_timer_define_thread(mrb);
+  mrb_timer_define_ring(mrb, timer);
+  mrb_timer_define_wheel(mrb, timer);
+  mrb_timer_define_deadline_set(mrb, timer);
+  mrb_timer_define_scheduler(mrb, timer);
+  mrb_timer_define_timeout(mrb, timer);
+  mrb_timer_define_siginfo(mrb, timer);
+  mrb_timer_define_metrics(mrb, timer);
+  mrb_timer_define_worker(mrb, timer);
+  mrb_timer_define_shard(mrb, timer);
+#ifdef MRB_TIMER_HAVE_DISPATCHER
+  mrb_timer_define_profiler(mrb, timer);
+#endif
+#ifdef __linux__
+  mrb_timer_define_fd(mrb, timer);
+#endif
 
   EXPORT_CLOCK_CONST(CLOCK_REALTIME);
   EXPORT_CLOCK_CONST(CLOCK_MONOTONIC);
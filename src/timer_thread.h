@@ -0,0 +1,177 @@
+#ifndef MRB_TIMER_THREAD_H
+#define MRB_TIMER_THREAD_H
+
+#include <mruby.h>
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+/* OSX does not support POSIX Timer... */
+#ifndef __APPLE__
+
+/* signal name/number resolution shared by every backend */
+int mrb_timer_to_signo(mrb_state *mrb, mrb_value vsig);
+/* next deadline of an aligned schedule, see Timer::POSIX#start_every */
+uint64_t mrb_timer_align_next(uint64_t now_ns, uint64_t period_ns, uint64_t offset_ns);
+
+/* lateness of each expiry against its schedule, see Timer::POSIX#stats */
+#define MRB_TIMER_STATS_BUCKETS 64
+
+struct mrb_timer_stats {
+  clockid_t clockid;
+  /* schedule of the current arm, first_ns is 0 while disarmed */
+  uint64_t first_ns;
+  uint64_t interval_ns;
+  uint64_t next_index; /* index of the next expiry expected */
+  uint64_t fired;
+  uint64_t overruns; /* expiries delivered late enough to be merged into a later one */
+  uint64_t min_ns;
+  uint64_t max_ns;
+  uint64_t sum_ns;
+  uint32_t hist[MRB_TIMER_STATS_BUCKETS]; /* by floor(log2(lateness_ns)) */
+};
+
+/* all but to_hash are safe from any thread */
+void mrb_timer_stats_reset(struct mrb_timer_stats *st);
+void mrb_timer_stats_arm(struct mrb_timer_stats *st, uint64_t first_ns, uint64_t interval_ns);
+void mrb_timer_stats_record(struct mrb_timer_stats *st, uint64_t lateness_ns, uint64_t skipped);
+/* record an expiry happening now, against the schedule of the current arm */
+void mrb_timer_stats_record_now(struct mrb_timer_stats *st);
+mrb_value mrb_timer_stats_to_hash(mrb_state *mrb, struct mrb_timer_stats *st);
+
+/* process wide counters, relaxed atomics, see Timer.metrics */
+enum mrb_timer_metric {
+  MRB_TIMER_METRIC_LIVE_POSIX,
+  MRB_TIMER_METRIC_LIVE_WHEEL,
+  MRB_TIMER_METRIC_LIVE_SCHEDULER,
+  MRB_TIMER_METRIC_LIVE_THREAD,
+  MRB_TIMER_METRIC_LIVE_DEADLINE_SETS,
+  MRB_TIMER_METRIC_LIVE_DEADLINES,
+  /* Timer::POSIX by clock */
+  MRB_TIMER_METRIC_LIVE_MONOTONIC,
+  MRB_TIMER_METRIC_LIVE_REALTIME,
+  MRB_TIMER_METRIC_LIVE_CPUTIME,
+  MRB_TIMER_METRIC_LIVE_OTHER_CLOCK,
+  /* Timer::POSIX by notification */
+  MRB_TIMER_METRIC_LIVE_SIGNAL,
+  MRB_TIMER_METRIC_LIVE_THREAD_TARGETED,
+  MRB_TIMER_METRIC_LIVE_QUEUED,
+  MRB_TIMER_METRIC_LIVE_NO_SIGNAL,
+  MRB_TIMER_METRIC_ARMS,
+  MRB_TIMER_METRIC_CANCELS,
+  MRB_TIMER_METRIC_FIRES,
+  MRB_TIMER_METRIC_OVERRUNS,
+  MRB_TIMER_METRIC_COUNT
+};
+
+void mrb_timer_metric_add(enum mrb_timer_metric metric, int64_t delta);
+void mrb_timer_define_metrics(mrb_state *mrb, struct RClass *timer);
+
+/* notification target of thread targeted (or pooled, queued) Timer::POSIX */
+struct mrb_timer_posix_thread_param {
+  int signo;      /* 0 sends no signal */
+  int has_thread; /* the whole process is signalled without it */
+  pthread_t thread_id;
+  int queued; /* push to the event queue instead of signalling */
+  uint32_t worker; /* Timer.worker handle to signal instead of thread_id, 0 for none */
+  uint32_t id;
+  int pooled; /* the target is rewritten on checkout, read it under the pool param lock */
+  struct mrb_timer_stats stats;
+};
+
+/* signo to the thread or the process, with id in sival_int; see Timer.dispatch */
+void mrb_timer_send_signal(int signo, int has_thread, pthread_t thread_id, uint32_t id);
+void mrb_timer_define_siginfo(mrb_state *mrb, struct RClass *timer);
+
+/* membership of a timer in the set of a worker thread, see Timer.worker */
+struct mrb_timer_worker_link {
+  struct mrb_timer_worker_link *next;
+  struct mrb_timer_worker_link **pprev; /* NULL while detached */
+  timer_t timer;
+  uint32_t handle;
+};
+
+/* handle of the calling thread, registered on first use; 0 on failure with errno set */
+uint32_t mrb_timer_worker_self(void);
+/* target of a live worker, -1 once it has exited */
+int mrb_timer_worker_lookup(uint32_t handle, pthread_t *thread, pid_t *tid);
+/* the timer is disarmed and detached when the worker exits, -1 if it already has */
+int mrb_timer_worker_attach(uint32_t handle, struct mrb_timer_worker_link *link, timer_t timer);
+/* before timer_delete, safe on a detached link */
+void mrb_timer_worker_detach(struct mrb_timer_worker_link *link);
+/* like mrb_timer_send_signal, nothing is sent once the worker has exited */
+void mrb_timer_worker_send_signal(uint32_t handle, int signo, uint32_t id);
+void mrb_timer_define_worker(mrb_state *mrb, struct RClass *timer);
+
+/* per CPU shards of the thread backed backends, -1 is the unpinned default */
+#define MRB_TIMER_MAX_SHARDS 256
+int mrb_timer_shard_count(void);
+int mrb_timer_shard_arg(mrb_state *mrb, mrb_value v);
+void mrb_timer_shard_attr(pthread_attr_t *attr, int shard);
+void mrb_timer_define_shard(mrb_state *mrb, struct RClass *timer);
+
+/* expiry event queue, see Timer.drain_events */
+struct mrb_timer_event {
+  uint32_t id;
+  uint32_t count;
+  uint64_t ts_ns; /* CLOCK_MONOTONIC */
+};
+
+uint32_t mrb_timer_next_id(void);
+/* safe from any thread, returns -1 when the queue is full */
+int mrb_timer_ring_push(uint32_t id, uint32_t count);
+int mrb_timer_ring_pop(struct mrb_timer_event *ev);
+uint64_t mrb_timer_ring_depth(void);
+uint64_t mrb_timer_ring_dropped(void);
+void mrb_timer_define_ring(mrb_state *mrb, struct RClass *timer);
+
+#if defined(__linux__) && defined(SIGEV_THREAD_ID)
+#define MRB_TIMER_HAVE_DISPATCHER 1
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+/* Timer::DISPATCHER_SIGNAL, taken by the dispatcher threads, EBUSY when the application handles it */
+#define MRB_TIMER_DISPATCHER_SIGNAL SIGRTMAX
+
+/* dispatcher thread of a shard, returns -1 with errno when it cannot start */
+int mrb_timer_dispatcher_setup(int shard, pid_t *tid, int *signo);
+/* returns 0 when the param cannot be registered */
+uintptr_t mrb_timer_dispatcher_register(int shard, struct mrb_timer_posix_thread_param *param);
+void mrb_timer_dispatcher_unregister(int shard, uintptr_t handle);
+/* held while the dispatcher reads a registered param, to change one in place */
+void mrb_timer_dispatcher_lock(int shard);
+void mrb_timer_dispatcher_unlock(int shard);
+/* CPU time used by every dispatcher thread so far */
+uint64_t mrb_timer_dispatcher_cpu_ns(void);
+
+/* Timer::Profiler, needs SIGEV_THREAD_ID as well */
+void mrb_timer_define_profiler(mrb_state *mrb, struct RClass *timer);
+#endif
+
+/* TimerThread a.k.a. Timer::MRubyThread */
+void mrb_timer_define_thread(mrb_state *mrb);
+
+/* Timer.timeout scopes */
+void mrb_timer_define_timeout(mrb_state *mrb, struct RClass *timer);
+
+/* Timer::Scheduler */
+void mrb_timer_define_scheduler(mrb_state *mrb, struct RClass *timer);
+
+/* Timer::Wheel */
+void mrb_timer_define_wheel(mrb_state *mrb, struct RClass *timer);
+
+/* Timer::DeadlineSet */
+void mrb_timer_define_deadline_set(mrb_state *mrb, struct RClass *timer);
+
+#ifdef __linux__
+/* Timer::FD */
+void mrb_timer_define_fd(mrb_state *mrb, struct RClass *timer);
+#endif
+
+#endif
+
+#endif
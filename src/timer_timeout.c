@@ -0,0 +1,369 @@
+#define _GNU_SOURCE 1
+
+#include <mruby.h>
+#include <mruby/class.h>
+#include <mruby/error.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "timer_thread.h"
+
+#ifndef __APPLE__
+
+/*
+ * Timer.timeout scopes. Each thread keeps its open deadlines in a binary
+ * min-heap and one kernel timer armed to the earliest of them, so entering
+ * or leaving a scope costs at most one timer_settime.
+ *
+ * The timer sends TIMEOUT_SIGNAL to its thread (SIGEV_THREAD_ID). The
+ * handler has no SA_RESTART, so a blocking system call of that thread
+ * returns early with EINTR, and it sets a flag for the VM: when mruby is
+ * built with its debug hook (MRB_ENABLE_DEBUG_HOOK), a code fetch hook
+ * installed while a scope is open raises Timer::TimeoutError at the next
+ * instruction of the block, a runaway loop included. Only instructions deeper
+ * than the frame of Timer.timeout are interrupted, so its ensure always closes
+ * the scope. Without the hook, or when another hook is installed, the deadline
+ * is only checked when the scope exits and on Timer.check_timeout.
+ */
+
+#define MRB_TIMER_TIMEOUT_SIGNAL (SIGRTMAX - 1)
+
+#if defined(MRB_TIMER_HAVE_DISPATCHER) && (defined(MRB_ENABLE_DEBUG_HOOK) || defined(MRB_USE_DEBUG_HOOK))
+#define MRB_TIMER_TIMEOUT_INTERRUPTS 1
+#endif
+
+struct mrb_timer_scope {
+  uint64_t deadline_ns; /* CLOCK_MONOTONIC */
+  uint64_t token;
+  struct mrb_context *c; /* context and callinfo depth of the Timer.timeout frame */
+  ptrdiff_t depth;
+};
+
+struct mrb_timer_scopes {
+  struct mrb_timer_scope *heap;
+  size_t len;
+  size_t capa;
+  uint64_t last_token;
+  uint64_t armed_ns; /* 0 while disarmed */
+  int has_timer;
+  timer_t timer;
+};
+
+static pthread_key_t scopes_key;
+static pthread_once_t scopes_once = PTHREAD_ONCE_INIT;
+static int scopes_errno = 0;
+static int scopes_signal_taken = 0; /* the application handles TIMEOUT_SIGNAL itself */
+static __thread volatile sig_atomic_t scope_fired = 0;
+
+static uint64_t scope_clock_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void scopes_destroy(void *p)
+{
+  struct mrb_timer_scopes *st = (struct mrb_timer_scopes *)p;
+
+  if (st->has_timer) {
+    timer_delete(st->timer);
+  }
+  free(st->heap);
+  free(st);
+}
+
+/* the signal interrupts system calls, the flag is for the fetch hook */
+static void scope_signal_handler(int signo)
+{
+  scope_fired = 1;
+}
+
+static void scopes_setup(void)
+{
+  scopes_errno = pthread_key_create(&scopes_key, scopes_destroy);
+#ifdef MRB_TIMER_HAVE_DISPATCHER
+  if (!scopes_errno) {
+    struct sigaction sa, old;
+    /* never replace a handler of the application */
+    sigaction(MRB_TIMER_TIMEOUT_SIGNAL, NULL, &old);
+    if ((old.sa_flags & SA_SIGINFO) || old.sa_handler != SIG_DFL) {
+      scopes_signal_taken = 1;
+      return;
+    }
+    memset(&sa, 0, sizeof(struct sigaction));
+    sa.sa_handler = scope_signal_handler;
+    sigemptyset(&sa.sa_mask);
+    /* no SA_RESTART; only the thread of a scope is ever sent it */
+    sigaction(MRB_TIMER_TIMEOUT_SIGNAL, &sa, NULL);
+  }
+#endif
+}
+
+static struct mrb_timer_scopes *scopes_get(mrb_state *mrb)
+{
+  struct mrb_timer_scopes *st;
+
+  pthread_once(&scopes_once, scopes_setup);
+  if (scopes_errno) {
+    errno = scopes_errno;
+    mrb_sys_fail(mrb, "pthread_key_create");
+  }
+  if (scopes_signal_taken) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Timer::TIMEOUT_SIGNAL already has a handler, Timer.timeout cannot use it");
+  }
+  st = (struct mrb_timer_scopes *)pthread_getspecific(scopes_key);
+  if (!st) {
+    st = (struct mrb_timer_scopes *)calloc(1, sizeof(struct mrb_timer_scopes));
+    if (!st) {
+      mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot allocate timeout scopes");
+    }
+    pthread_setspecific(scopes_key, st);
+  }
+  return st;
+}
+
+static void scope_swap(struct mrb_timer_scope *heap, size_t a, size_t b)
+{
+  struct mrb_timer_scope tmp = heap[a];
+  heap[a] = heap[b];
+  heap[b] = tmp;
+}
+
+static void scope_sift_up(struct mrb_timer_scopes *st, size_t i)
+{
+  while (i > 0 && st->heap[(i - 1) / 2].deadline_ns > st->heap[i].deadline_ns) {
+    scope_swap(st->heap, i, (i - 1) / 2);
+    i = (i - 1) / 2;
+  }
+}
+
+static void scope_sift_down(struct mrb_timer_scopes *st, size_t i)
+{
+  size_t l, r, min;
+
+  for (;;) {
+    l = 2 * i + 1;
+    r = l + 1;
+    min = i;
+    if (l < st->len && st->heap[l].deadline_ns < st->heap[min].deadline_ns) {
+      min = l;
+    }
+    if (r < st->len && st->heap[r].deadline_ns < st->heap[min].deadline_ns) {
+      min = r;
+    }
+    if (min == i) {
+      return;
+    }
+    scope_swap(st->heap, i, min);
+    i = min;
+  }
+}
+
+static void scope_raise(mrb_state *mrb)
+{
+  mrb_raise(mrb, mrb_class_get_under(mrb, mrb_module_get(mrb, "Timer"), "TimeoutError"), "execution expired");
+}
+
+#ifdef MRB_TIMER_TIMEOUT_INTERRUPTS
+/* VM context, before each instruction while a scope is open: one thread local load until the signal came */
+static void scope_fetch_hook(mrb_state *mrb, struct mrb_irep *irep, const mrb_code *pc, mrb_value *regs)
+{
+  struct mrb_timer_scopes *st;
+  struct mrb_timer_scope *sc;
+
+  if (!scope_fired) {
+    return;
+  }
+  st = (struct mrb_timer_scopes *)pthread_getspecific(scopes_key);
+  if (!st || !st->len) {
+    scope_fired = 0;
+    return;
+  }
+  sc = &st->heap[0];
+  if (scope_clock_ns() < sc->deadline_ns) {
+    /* the signal of a deadline since closed */
+    scope_fired = 0;
+    return;
+  }
+  /* keep the flag until the block runs again: never raise in the frame that closes the scope */
+  if (mrb->c != sc->c || mrb->c->ci - mrb->c->cibase <= sc->depth) {
+    return;
+  }
+  scope_fired = 0;
+  scope_raise(mrb);
+}
+#endif
+
+/* Point the thread's kernel timer at the earliest deadline, a no-op when it already is */
+static int scopes_rearm(struct mrb_timer_scopes *st)
+{
+#ifdef MRB_TIMER_HAVE_DISPATCHER
+  uint64_t target = st->len ? st->heap[0].deadline_ns : 0;
+  struct itimerspec ts;
+
+  if (target == st->armed_ns) {
+    return 0;
+  }
+  if (!st->has_timer) {
+    struct sigevent sev;
+    if (!target) {
+      return 0;
+    }
+    memset(&sev, 0, sizeof(struct sigevent));
+    sev.sigev_notify = SIGEV_THREAD_ID;
+    sev.sigev_notify_thread_id = (pid_t)syscall(SYS_gettid);
+    sev.sigev_signo = MRB_TIMER_TIMEOUT_SIGNAL;
+    if (timer_create(CLOCK_MONOTONIC, &sev, &st->timer) == -1) {
+      return -1;
+    }
+    st->has_timer = 1;
+  }
+
+  memset(&ts, 0, sizeof(struct itimerspec));
+  ts.it_value.tv_sec = (time_t)(target / 1000000000ULL);
+  ts.it_value.tv_nsec = (long)(target % 1000000000ULL);
+  if (timer_settime(st->timer, TIMER_ABSTIME, &ts, NULL) == -1) {
+    return -1;
+  }
+  st->armed_ns = target;
+#endif
+  return 0;
+}
+
+/* Timer.__timeout_push(msec) => token, opens a scope */
+static mrb_value mrb_timer_timeout_push(mrb_state *mrb, mrb_value self)
+{
+  struct mrb_timer_scopes *st = scopes_get(mrb);
+  mrb_int msec;
+  size_t i;
+
+  if (mrb_get_args(mrb, "i", &msec) == -1) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot get arguments");
+  }
+  if (msec < 0) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "Timeout must be 0 or positive");
+  }
+
+  if (st->len == st->capa) {
+    size_t capa = st->capa ? st->capa * 2 : 8;
+    struct mrb_timer_scope *heap = (struct mrb_timer_scope *)realloc(st->heap, sizeof(*heap) * capa);
+    if (!heap) {
+      mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot allocate timeout scopes");
+    }
+    st->heap = heap;
+    st->capa = capa;
+  }
+  i = st->len++;
+  st->heap[i].deadline_ns = scope_clock_ns() + (uint64_t)msec * 1000000ULL;
+  st->heap[i].token = ++st->last_token;
+  /* the caller's frame, below the one of this cfunc */
+  st->heap[i].c = mrb->c;
+  st->heap[i].depth = mrb->c->ci - mrb->c->cibase - 1;
+  scope_sift_up(st, i);
+#ifdef MRB_TIMER_TIMEOUT_INTERRUPTS
+  if (!mrb->code_fetch_hook) {
+    mrb->code_fetch_hook = scope_fetch_hook;
+  }
+#endif
+
+  if (scopes_rearm(st) == -1) {
+    mrb_sys_fail(mrb, "timeout timer");
+  }
+  return mrb_fixnum_value((mrb_int)st->last_token);
+}
+
+/* Timer.__timeout_pop(token) => true when the deadline of the scope has passed */
+static mrb_value mrb_timer_timeout_pop(mrb_state *mrb, mrb_value self)
+{
+  struct mrb_timer_scopes *st = scopes_get(mrb);
+  mrb_int token;
+  mrb_bool expired;
+  size_t i;
+
+  if (mrb_get_args(mrb, "i", &token) == -1) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot get arguments");
+  }
+
+  /* scopes nest, the one to close is nearly always a recent one */
+  for (i = st->len; i > 0; i--) {
+    if (st->heap[i - 1].token == (uint64_t)token) {
+      break;
+    }
+  }
+  if (!i) {
+    return mrb_false_value();
+  }
+  i--;
+  expired = scope_clock_ns() >= st->heap[i].deadline_ns;
+
+  st->heap[i] = st->heap[--st->len];
+  if (i < st->len) {
+    scope_sift_down(st, i);
+    scope_sift_up(st, i);
+  }
+#ifdef MRB_TIMER_TIMEOUT_INTERRUPTS
+  if (!st->len) {
+    scope_fired = 0;
+    if (mrb->code_fetch_hook == scope_fetch_hook) {
+      mrb->code_fetch_hook = NULL;
+    }
+  }
+#endif
+
+  if (scopes_rearm(st) == -1) {
+    mrb_sys_fail(mrb, "timeout timer");
+  }
+  return mrb_bool_value(expired);
+}
+
+/* Raises Timer::TimeoutError when the earliest open deadline has passed */
+static mrb_value mrb_timer_check_timeout(mrb_state *mrb, mrb_value self)
+{
+  struct mrb_timer_scopes *st = scopes_get(mrb);
+
+  if (st->len && scope_clock_ns() >= st->heap[0].deadline_ns) {
+    scope_raise(mrb);
+  }
+  return mrb_nil_value();
+}
+
+/* nsec left before the earliest open deadline, nil outside of any scope */
+static mrb_value mrb_timer_timeout_remaining_ns(mrb_state *mrb, mrb_value self)
+{
+  struct mrb_timer_scopes *st = scopes_get(mrb);
+  uint64_t now;
+
+  if (!st->len) {
+    return mrb_nil_value();
+  }
+  now = scope_clock_ns();
+  return mrb_fixnum_value(now >= st->heap[0].deadline_ns ? 0 : (mrb_int)(st->heap[0].deadline_ns - now));
+}
+
+void mrb_timer_define_timeout(mrb_state *mrb, struct RClass *timer)
+{
+  mrb_define_class_under(mrb, timer, "TimeoutError", E_RUNTIME_ERROR);
+  mrb_define_module_function(mrb, timer, "__timeout_push", mrb_timer_timeout_push, MRB_ARGS_REQ(1));
+  mrb_define_module_function(mrb, timer, "__timeout_pop", mrb_timer_timeout_pop, MRB_ARGS_REQ(1));
+  mrb_define_module_function(mrb, timer, "check_timeout", mrb_timer_check_timeout, MRB_ARGS_NONE());
+  mrb_define_module_function(mrb, timer, "timeout_remaining_ns", mrb_timer_timeout_remaining_ns, MRB_ARGS_NONE());
+#ifdef MRB_TIMER_HAVE_DISPATCHER
+  mrb_define_const(mrb, timer, "TIMEOUT_SIGNAL", mrb_fixnum_value(MRB_TIMER_TIMEOUT_SIGNAL));
+#endif
+#ifdef MRB_TIMER_TIMEOUT_INTERRUPTS
+  mrb_define_const(mrb, timer, "TIMEOUT_INTERRUPTS", mrb_true_value());
+#else
+  mrb_define_const(mrb, timer, "TIMEOUT_INTERRUPTS", mrb_false_value());
+#endif
+}
+
+#endif
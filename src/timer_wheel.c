@@ -0,0 +1,563 @@
+#define _GNU_SOURCE 1
+
+#include <mruby.h>
+#include <mruby/class.h>
+#include <mruby/data.h>
+#include <mruby/error.h>
+#include <mruby/hash.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "timer_thread.h"
+
+#ifndef __APPLE__
+
+/*
+ * Timer::Wheel multiplexes any number of timers onto one C thread.
+ *
+ * Entries are kept in a hierarchical timing wheel (256 root slots plus four
+ * levels of 64 slots, 1 msec per tick), so start and stop are O(1) list
+ * operations. The wheel thread sleeps in pthread_cond_timedwait on
+ * CLOCK_MONOTONIC until the nearest tick with work, like the scheduler
+ * thread; it is only woken early when a new entry becomes the earliest one,
+ * and every entry of a due slot is expired in the same pass. No thread is
+ * created per tick. With shard: n the entry goes to a wheel whose thread is
+ * pinned to CPU n.
+ */
+
+#define WHEEL_TICK_NSEC 1000000ULL
+#define WHEEL_ROOT_BITS 8
+#define WHEEL_LEVEL_BITS 6
+#define WHEEL_LEVELS 4
+#define WHEEL_ROOT_SIZE (1 << WHEEL_ROOT_BITS)
+#define WHEEL_LEVEL_SIZE (1 << WHEEL_LEVEL_BITS)
+#define WHEEL_ROOT_MASK (WHEEL_ROOT_SIZE - 1)
+#define WHEEL_LEVEL_MASK (WHEEL_LEVEL_SIZE - 1)
+#define WHEEL_MAX_TICKS ((1ULL << (WHEEL_ROOT_BITS + WHEEL_LEVELS * WHEEL_LEVEL_BITS)) - 1)
+#define WHEEL_IDLE UINT64_MAX
+
+struct mrb_timer_wheel;
+
+struct mrb_timer_wheel_entry {
+  struct mrb_timer_wheel *owner;
+  struct mrb_timer_wheel_entry *next;
+  struct mrb_timer_wheel_entry **pprev; /* NULL while not armed */
+  uint64_t expires;                     /* ticks */
+  uint64_t interval;                    /* ticks, 0 for one shot */
+  int signo;                            /* 0 sends no signal */
+  int has_thread;
+  pthread_t thread_id;
+  int queued; /* push to the event queue instead of signalling */
+  uint32_t id;
+  uint64_t slack; /* ticks, expiries are rounded up to multiples of it */
+  struct mrb_timer_stats stats;
+};
+
+struct mrb_timer_wheel {
+  pthread_mutex_t lock;
+  pthread_cond_t wake; /* the wheel thread waits on it */
+  uint64_t base_ns;
+  uint64_t now;   /* next tick to be processed */
+  uint64_t armed; /* tick the wheel thread waits for */
+  size_t count;
+  int shard; /* -1 for the unpinned default */
+  struct mrb_timer_wheel_entry *root[WHEEL_ROOT_SIZE];
+  struct mrb_timer_wheel_entry *levels[WHEEL_LEVELS][WHEEL_LEVEL_SIZE];
+};
+
+/* index 0 is the default, shard n is at n + 1 */
+static struct mrb_timer_wheel *wheels[MRB_TIMER_MAX_SHARDS + 1];
+static pthread_mutex_t wheels_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t wheel_clock_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void wheel_link(struct mrb_timer_wheel_entry **head, struct mrb_timer_wheel_entry *e)
+{
+  e->next = *head;
+  if (e->next) {
+    e->next->pprev = &e->next;
+  }
+  e->pprev = head;
+  *head = e;
+}
+
+static void wheel_unlink(struct mrb_timer_wheel_entry *e)
+{
+  *e->pprev = e->next;
+  if (e->next) {
+    e->next->pprev = e->pprev;
+  }
+  e->next = NULL;
+  e->pprev = NULL;
+}
+
+static void wheel_place(struct mrb_timer_wheel *w, struct mrb_timer_wheel_entry *e)
+{
+  uint64_t idx;
+  int level;
+
+  if (e->expires < w->now) {
+    e->expires = w->now;
+  }
+  idx = e->expires - w->now;
+  if (idx > WHEEL_MAX_TICKS) {
+    idx = WHEEL_MAX_TICKS;
+    e->expires = w->now + idx;
+  }
+
+  if (idx < WHEEL_ROOT_SIZE) {
+    wheel_link(&w->root[e->expires & WHEEL_ROOT_MASK], e);
+    return;
+  }
+  for (level = 0; level < WHEEL_LEVELS - 1; level++) {
+    if (idx < (1ULL << (WHEEL_ROOT_BITS + (level + 1) * WHEEL_LEVEL_BITS))) {
+      break;
+    }
+  }
+  wheel_link(&w->levels[level][(e->expires >> (WHEEL_ROOT_BITS + level * WHEEL_LEVEL_BITS)) & WHEEL_LEVEL_MASK],
+             e);
+}
+
+/* Move one slot of an upper level down, returns its index */
+static int wheel_cascade(struct mrb_timer_wheel *w, int level)
+{
+  int idx = (int)((w->now >> (WHEEL_ROOT_BITS + level * WHEEL_LEVEL_BITS)) & WHEEL_LEVEL_MASK);
+  struct mrb_timer_wheel_entry *e = w->levels[level][idx], *next;
+
+  w->levels[level][idx] = NULL;
+  for (; e; e = next) {
+    next = e->next;
+    e->next = NULL;
+    e->pprev = NULL;
+    wheel_place(w, e);
+  }
+  return idx;
+}
+
+static void wheel_notify(struct mrb_timer_wheel_entry *e)
+{
+  if (e->queued) {
+    mrb_timer_ring_push(e->id, 1);
+    return;
+  }
+  if (e->signo <= 0) {
+    return;
+  }
+  mrb_timer_send_signal(e->signo, e->has_thread, e->thread_id, e->id);
+}
+
+/* Expire every tick up to and including target at now_ns; called with the lock held */
+static void wheel_run_until(struct mrb_timer_wheel *w, uint64_t target, uint64_t now_ns)
+{
+  uint64_t due_ns;
+  struct mrb_timer_wheel_entry *e, *next;
+  int level;
+
+  while (w->now <= target) {
+    int idx = (int)(w->now & WHEEL_ROOT_MASK);
+    if (w->count == 0) {
+      /* nothing left, just catch up */
+      w->now = target + 1;
+      break;
+    }
+    if (!idx) {
+      for (level = 0; level < WHEEL_LEVELS && !wheel_cascade(w, level); level++)
+        ;
+    }
+
+    e = w->root[idx];
+    w->root[idx] = NULL;
+    w->now++;
+
+    for (; e; e = next) {
+      next = e->next;
+      e->next = NULL;
+      e->pprev = NULL;
+      due_ns = w->base_ns + e->expires * WHEEL_TICK_NSEC;
+      mrb_timer_stats_record(&e->stats, now_ns > due_ns ? now_ns - due_ns : 0, 0);
+      wheel_notify(e);
+      if (e->interval) {
+        e->expires += e->interval;
+        wheel_place(w, e);
+      } else {
+        w->count--;
+      }
+    }
+  }
+}
+
+/* The nearest tick that has work: a filled root slot or the next cascade */
+static uint64_t wheel_next_tick(struct mrb_timer_wheel *w)
+{
+  uint64_t t = w->now;
+  int i;
+
+  for (i = 0; i < WHEEL_ROOT_SIZE; i++, t++) {
+    if (!(t & WHEEL_ROOT_MASK) || w->root[t & WHEEL_ROOT_MASK]) {
+      break;
+    }
+  }
+  return t;
+}
+
+/* Point the wheel thread at the nearest tick with work; called with the lock held */
+static void wheel_rearm(struct mrb_timer_wheel *w)
+{
+  uint64_t next = w->count ? wheel_next_tick(w) : WHEEL_IDLE;
+
+  if (next == w->armed) {
+    return;
+  }
+  /* a later tick needs no wake up, the thread looks again when it wakes */
+  if (next < w->armed) {
+    pthread_cond_signal(&w->wake);
+  }
+  w->armed = next;
+}
+
+static void *wheel_func(void *arg)
+{
+  struct mrb_timer_wheel *w = (struct mrb_timer_wheel *)arg;
+  struct timespec ts;
+  uint64_t now_ns, due_ns;
+
+  pthread_mutex_lock(&w->lock);
+  for (;;) {
+    if (w->armed == WHEEL_IDLE) {
+      pthread_cond_wait(&w->wake, &w->lock);
+      continue;
+    }
+    due_ns = w->base_ns + w->armed * WHEEL_TICK_NSEC;
+    now_ns = wheel_clock_ns();
+    if (now_ns < due_ns) {
+      ts.tv_sec = (time_t)(due_ns / 1000000000ULL);
+      ts.tv_nsec = (long)(due_ns % 1000000000ULL);
+      pthread_cond_timedwait(&w->wake, &w->lock, &ts);
+      continue;
+    }
+    w->armed = WHEEL_IDLE;
+    wheel_run_until(w, (now_ns - w->base_ns) / WHEEL_TICK_NSEC, now_ns);
+    wheel_rearm(w);
+  }
+  return NULL;
+}
+
+/* The wheel of a shard, its thread started on first use; NULL with errno on failure */
+static struct mrb_timer_wheel *wheel_get(int shard)
+{
+  struct mrb_timer_wheel *w;
+  pthread_condattr_t attr;
+  pthread_attr_t tattr;
+  pthread_t th;
+  sigset_t all, old;
+  int err;
+
+  pthread_mutex_lock(&wheels_lock);
+  w = wheels[shard + 1];
+  if (w) {
+    pthread_mutex_unlock(&wheels_lock);
+    return w;
+  }
+  w = (struct mrb_timer_wheel *)calloc(1, sizeof(struct mrb_timer_wheel));
+  if (!w) {
+    pthread_mutex_unlock(&wheels_lock);
+    errno = ENOMEM;
+    return NULL;
+  }
+  pthread_mutex_init(&w->lock, NULL);
+  w->shard = shard;
+  w->base_ns = wheel_clock_ns();
+  w->armed = WHEEL_IDLE;
+
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&w->wake, &attr);
+  pthread_condattr_destroy(&attr);
+
+  /* the wheel takes no signal; pthread_create copies the attributes, cpuset included */
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  pthread_attr_init(&tattr);
+  pthread_attr_setdetachstate(&tattr, PTHREAD_CREATE_DETACHED);
+  mrb_timer_shard_attr(&tattr, shard);
+  err = pthread_create(&th, &tattr, wheel_func, w);
+  pthread_attr_destroy(&tattr);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+  if (err) {
+    pthread_cond_destroy(&w->wake);
+    pthread_mutex_destroy(&w->lock);
+    free(w);
+    pthread_mutex_unlock(&wheels_lock);
+    errno = err;
+    return NULL;
+  }
+  wheels[shard + 1] = w;
+  pthread_mutex_unlock(&wheels_lock);
+  return w;
+}
+
+static void mrb_timer_wheel_free(mrb_state *mrb, void *p)
+{
+  struct mrb_timer_wheel_entry *e = (struct mrb_timer_wheel_entry *)p;
+  struct mrb_timer_wheel *w;
+
+  if (!e) {
+    return;
+  }
+  w = e->owner;
+  pthread_mutex_lock(&w->lock);
+  if (e->pprev) {
+    wheel_unlink(e);
+    w->count--;
+  }
+  pthread_mutex_unlock(&w->lock);
+  mrb_free(mrb, e);
+  mrb_timer_metric_add(MRB_TIMER_METRIC_LIVE_WHEEL, -1);
+}
+
+static const struct mrb_data_type mrb_timer_wheel_data_type = {"mrb_timer_wheel_data", mrb_timer_wheel_free};
+
+/* initialize, accepts signal:, thread_id:, queue:, slack: and shard: like Timer::POSIX */
+static mrb_value mrb_timer_wheel_init(mrb_state *mrb, mrb_value self)
+{
+  struct mrb_timer_wheel_entry *e;
+  struct mrb_timer_wheel *w;
+  mrb_value options = mrb_nil_value();
+  mrb_value signo, thread_id_arg, slack_arg;
+  int sno = SIGALRM, has_thread = 0, queued = 0, shard = -1;
+  mrb_int slack = 0;
+  pthread_t thread_id = 0;
+
+  if (mrb_get_args(mrb, "|o", &options) == -1) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot get arguments");
+  }
+
+  if (mrb_hash_p(options)) {
+    signo = mrb_hash_fetch(mrb, options, mrb_symbol_value(mrb_intern_lit(mrb, "signal")), mrb_undef_value());
+    if (mrb_nil_p(signo)) {
+      sno = 0;
+    } else if (!mrb_undef_p(signo)) {
+      sno = mrb_timer_to_signo(mrb, signo);
+      if (sno <= 0) {
+        mrb_raise(mrb, E_ARGUMENT_ERROR, "Invalid value for signal");
+      }
+    }
+
+    thread_id_arg = mrb_hash_get(mrb, options, mrb_symbol_value(mrb_intern_lit(mrb, "thread_id")));
+    if (mrb_float_p(thread_id_arg)) {
+      thread_id = (pthread_t)mrb_float(thread_id_arg);
+      has_thread = 1;
+    }
+
+    if (mrb_test(mrb_hash_get(mrb, options, mrb_symbol_value(mrb_intern_lit(mrb, "queue"))))) {
+      queued = 1;
+      sno = 0;
+    }
+
+    slack_arg = mrb_hash_get(mrb, options, mrb_symbol_value(mrb_intern_lit(mrb, "slack")));
+    if (mrb_fixnum_p(slack_arg)) {
+      slack = mrb_fixnum(slack_arg);
+      if (slack < 0) {
+        mrb_raise(mrb, E_ARGUMENT_ERROR, "Slack must be 0 or positive");
+      }
+    }
+
+    shard = mrb_timer_shard_arg(mrb, mrb_hash_get(mrb, options, mrb_symbol_value(mrb_intern_lit(mrb, "shard"))));
+  }
+
+  w = wheel_get(shard);
+  if (!w) {
+    mrb_sys_fail(mrb, "Timer::Wheel thread");
+  }
+
+  e = (struct mrb_timer_wheel_entry *)DATA_PTR(self);
+  if (e) {
+    mrb_timer_wheel_free(mrb, e);
+  }
+  DATA_TYPE(self) = &mrb_timer_wheel_data_type;
+  DATA_PTR(self) = NULL;
+
+  e = (struct mrb_timer_wheel_entry *)mrb_malloc(mrb, sizeof(struct mrb_timer_wheel_entry));
+  memset(e, 0, sizeof(struct mrb_timer_wheel_entry));
+  e->owner = w;
+  e->signo = sno;
+  e->has_thread = has_thread;
+  e->thread_id = thread_id;
+  e->queued = queued;
+  e->id = mrb_timer_next_id();
+  e->slack = (uint64_t)slack * 1000000ULL / WHEEL_TICK_NSEC;
+  e->stats.clockid = CLOCK_MONOTONIC;
+  mrb_timer_stats_reset(&e->stats);
+  mrb_timer_metric_add(MRB_TIMER_METRIC_LIVE_WHEEL, 1);
+
+  DATA_PTR(self) = e;
+  return self;
+}
+
+static mrb_value mrb_timer_wheel_stop(mrb_state *mrb, mrb_value self)
+{
+  struct mrb_timer_wheel_entry *e = DATA_PTR(self);
+  struct mrb_timer_wheel *w = e->owner;
+
+  pthread_mutex_lock(&w->lock);
+  if (e->pprev) {
+    wheel_unlink(e);
+    w->count--;
+    mrb_timer_metric_add(MRB_TIMER_METRIC_CANCELS, 1);
+  }
+  pthread_mutex_unlock(&w->lock);
+
+  return self;
+}
+
+static mrb_value mrb_timer_wheel_start(mrb_state *mrb, mrb_value self)
+{
+  struct mrb_timer_wheel_entry *e = DATA_PTR(self);
+  struct mrb_timer_wheel *w = e->owner;
+  mrb_int start, interval = 0;
+  uint64_t now;
+
+  /* start and interval should be msec */
+  if (mrb_get_args(mrb, "i|i", &start, &interval) == -1) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot get arguments");
+  }
+  if (start < 0 || interval < 0) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "Values must be 0 or positive");
+  }
+  /* same as timer_settime, zero start disarms */
+  if (start == 0) {
+    return mrb_timer_wheel_stop(mrb, self);
+  }
+
+  pthread_mutex_lock(&w->lock);
+  if (e->pprev) {
+    wheel_unlink(e);
+    w->count--;
+  }
+  /* round the current time up so that no entry expires early */
+  now = (wheel_clock_ns() - w->base_ns + WHEEL_TICK_NSEC - 1) / WHEEL_TICK_NSEC;
+  if (w->count == 0 && w->now < now) {
+    w->now = now;
+  }
+  e->expires = now + (uint64_t)start * 1000000ULL / WHEEL_TICK_NSEC;
+  e->interval = (uint64_t)interval * 1000000ULL / WHEEL_TICK_NSEC;
+  if (e->slack > 1) {
+    /* share slots, and so wakeups, with the other entries of the same slack */
+    e->expires = (e->expires + e->slack - 1) / e->slack * e->slack;
+    e->interval = (e->interval + e->slack - 1) / e->slack * e->slack;
+  }
+  wheel_place(w, e);
+  w->count++;
+  if (w->armed == WHEEL_IDLE || e->expires < w->armed) {
+    wheel_rearm(w);
+  }
+  pthread_mutex_unlock(&w->lock);
+  mrb_timer_metric_add(MRB_TIMER_METRIC_ARMS, 1);
+
+  return self;
+}
+
+static mrb_value mrb_timer_wheel_is_running(mrb_state *mrb, mrb_value self)
+{
+  struct mrb_timer_wheel_entry *e = DATA_PTR(self);
+  struct mrb_timer_wheel *w = e->owner;
+  mrb_bool running;
+
+  pthread_mutex_lock(&w->lock);
+  running = e->pprev != NULL;
+  pthread_mutex_unlock(&w->lock);
+
+  return mrb_bool_value(running);
+}
+
+static mrb_value mrb_timer_wheel_signo(mrb_state *mrb, mrb_value self)
+{
+  struct mrb_timer_wheel_entry *e = DATA_PTR(self);
+  if (e->signo > 0) {
+    return mrb_fixnum_value(e->signo);
+  } else {
+    return mrb_nil_value();
+  }
+}
+
+static mrb_value mrb_timer_wheel_id(mrb_state *mrb, mrb_value self)
+{
+  struct mrb_timer_wheel_entry *e = DATA_PTR(self);
+  return mrb_fixnum_value((mrb_int)e->id);
+}
+
+/* Lateness of the expiries against their tick, as Timer::POSIX#stats */
+static mrb_value mrb_timer_wheel_stats(mrb_state *mrb, mrb_value self)
+{
+  struct mrb_timer_wheel_entry *e = DATA_PTR(self);
+  return mrb_timer_stats_to_hash(mrb, &e->stats);
+}
+
+static mrb_value mrb_timer_wheel_reset_stats(mrb_state *mrb, mrb_value self)
+{
+  struct mrb_timer_wheel_entry *e = DATA_PTR(self);
+  mrb_timer_stats_reset(&e->stats);
+  return self;
+}
+
+/* Armed entries of every shard */
+static mrb_value mrb_timer_wheel_pending(mrb_state *mrb, mrb_value self)
+{
+  struct mrb_timer_wheel *w;
+  size_t count = 0;
+  int i;
+
+  pthread_mutex_lock(&wheels_lock);
+  for (i = 0; i <= MRB_TIMER_MAX_SHARDS; i++) {
+    if ((w = wheels[i])) {
+      pthread_mutex_lock(&w->lock);
+      count += w->count;
+      pthread_mutex_unlock(&w->lock);
+    }
+  }
+  pthread_mutex_unlock(&wheels_lock);
+
+  return mrb_fixnum_value((mrb_int)count);
+}
+
+/* Wheel shard of the entry, nil for the default one */
+static mrb_value mrb_timer_wheel_shard(mrb_state *mrb, mrb_value self)
+{
+  struct mrb_timer_wheel_entry *e = DATA_PTR(self);
+  return e->owner->shard >= 0 ? mrb_fixnum_value(e->owner->shard) : mrb_nil_value();
+}
+
+void mrb_timer_define_wheel(mrb_state *mrb, struct RClass *timer)
+{
+  struct RClass *w;
+
+  w = mrb_define_class_under(mrb, timer, "Wheel", mrb->object_class);
+  MRB_SET_INSTANCE_TT(w, MRB_TT_DATA);
+  mrb_define_method(mrb, w, "initialize", mrb_timer_wheel_init, MRB_ARGS_ARG(0, 1));
+  mrb_define_method(mrb, w, "start", mrb_timer_wheel_start, MRB_ARGS_ARG(1, 1));
+  mrb_define_method(mrb, w, "stop", mrb_timer_wheel_stop, MRB_ARGS_NONE());
+  mrb_define_method(mrb, w, "running?", mrb_timer_wheel_is_running, MRB_ARGS_NONE());
+  mrb_define_method(mrb, w, "signo", mrb_timer_wheel_signo, MRB_ARGS_NONE());
+  mrb_define_method(mrb, w, "id", mrb_timer_wheel_id, MRB_ARGS_NONE());
+  mrb_define_method(mrb, w, "shard", mrb_timer_wheel_shard, MRB_ARGS_NONE());
+  mrb_define_method(mrb, w, "stats", mrb_timer_wheel_stats, MRB_ARGS_NONE());
+  mrb_define_method(mrb, w, "reset_stats", mrb_timer_wheel_reset_stats, MRB_ARGS_NONE());
+  mrb_define_class_method(mrb, w, "pending", mrb_timer_wheel_pending, MRB_ARGS_NONE());
+
+  mrb_define_const(mrb, w, "TICK_NSEC", mrb_fixnum_value((mrb_int)WHEEL_TICK_NSEC));
+}
+
+#endif
@@ -0,0 +1,344 @@
+#define _GNU_SOURCE 1
+
+#include <mruby.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "timer_thread.h"
+
+#ifndef __APPLE__
+
+/*
+ * Worker threads. Timer.worker gives the calling thread a small Integer
+ * handle (slot index and generation) that can be copied between mruby-thread
+ * states, unlike a pthread_t carried in a Float. Timers created with worker:
+ * are linked into the set of that thread; the set is disarmed in one pass by
+ * Timer.cancel_worker, and when the thread exits, from a thread specific key
+ * destructor. A handle is never reused for another thread: a slot is
+ * retired once its 14 bit generation is used up, so nothing is sent to a
+ * thread that has gone. Timer.worker fails with EAGAIN after about 10^9
+ * threads.
+ */
+
+#define WORKER_INDEX_BITS 16
+#define WORKER_INDEX_MASK ((1U << WORKER_INDEX_BITS) - 1)
+/* handles stay below 2^30, a Fixnum even with 32 bit words */
+#define WORKER_GEN_MASK ((1U << 14) - 1)
+
+struct mrb_timer_worker {
+  pthread_t thread;
+  pid_t tid;
+  uint32_t gen;
+  int alive;
+  struct mrb_timer_worker_link *links;
+  size_t count;
+};
+
+/* slots are allocated one by one, so that links can point into them across a realloc */
+static struct mrb_timer_worker **workers = NULL;
+static uint32_t workers_len = 0;
+static uint32_t workers_capa = 0;
+static uint32_t *workers_free = NULL;
+static uint32_t workers_free_len = 0;
+static pthread_mutex_t workers_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_key_t worker_key;
+static pthread_once_t worker_once = PTHREAD_ONCE_INIT;
+static int worker_errno = 0;
+
+/* the live worker of handle, workers_lock held */
+static struct mrb_timer_worker *worker_find(uint32_t handle)
+{
+  uint32_t idx = handle & WORKER_INDEX_MASK;
+
+  if (idx >= workers_len || !workers[idx]->alive || workers[idx]->gen != handle >> WORKER_INDEX_BITS) {
+    return NULL;
+  }
+  return workers[idx];
+}
+
+/* disarm every timer of the worker, workers_lock held */
+static size_t worker_cancel(struct mrb_timer_worker *w)
+{
+  struct mrb_timer_worker_link *l;
+  struct itimerspec ts, old;
+  size_t n = 0, armed = 0;
+
+  memset(&ts, 0, sizeof(struct itimerspec));
+  for (l = w->links; l; l = l->next) {
+    if (timer_settime(l->timer, 0, &ts, &old) == 0) {
+      n++;
+      if (old.it_value.tv_sec || old.it_value.tv_nsec) {
+        armed++;
+      }
+    }
+  }
+  mrb_timer_metric_add(MRB_TIMER_METRIC_CANCELS, (int64_t)armed);
+  return n;
+}
+
+static void worker_exit(void *p)
+{
+  uint32_t handle = (uint32_t)(uintptr_t)p;
+  struct mrb_timer_worker *w;
+  struct mrb_timer_worker_link *l, *next;
+
+  pthread_mutex_lock(&workers_lock);
+  w = worker_find(handle);
+  if (w) {
+    worker_cancel(w);
+    for (l = w->links; l; l = next) {
+      next = l->next;
+      l->next = NULL;
+      l->pprev = NULL;
+    }
+    w->links = NULL;
+    w->count = 0;
+    w->alive = 0;
+    /* free_len never exceeds len, the array is grown with it */
+    if (w->gen < WORKER_GEN_MASK) {
+      workers_free[workers_free_len++] = handle & WORKER_INDEX_MASK;
+    }
+  }
+  pthread_mutex_unlock(&workers_lock);
+}
+
+static void worker_setup(void)
+{
+  worker_errno = pthread_key_create(&worker_key, worker_exit);
+}
+
+uint32_t mrb_timer_worker_self(void)
+{
+  struct mrb_timer_worker *w;
+  uint32_t idx, handle = 0;
+
+  pthread_once(&worker_once, worker_setup);
+  if (worker_errno) {
+    errno = worker_errno;
+    return 0;
+  }
+  handle = (uint32_t)(uintptr_t)pthread_getspecific(worker_key);
+  if (handle) {
+    return handle;
+  }
+
+  pthread_mutex_lock(&workers_lock);
+  if (workers_free_len) {
+    idx = workers_free[--workers_free_len];
+  } else {
+    if (workers_len == WORKER_INDEX_MASK + 1) {
+      errno = EAGAIN;
+      goto done;
+    }
+    if (workers_len == workers_capa) {
+      uint32_t capa = workers_capa ? workers_capa * 2 : 64;
+      struct mrb_timer_worker **slots = realloc(workers, sizeof(*slots) * capa);
+      uint32_t *free_list;
+      if (!slots) {
+        errno = ENOMEM;
+        goto done;
+      }
+      workers = slots;
+      free_list = realloc(workers_free, sizeof(uint32_t) * capa);
+      if (!free_list) {
+        errno = ENOMEM;
+        goto done;
+      }
+      workers_free = free_list;
+      workers_capa = capa;
+    }
+    w = (struct mrb_timer_worker *)calloc(1, sizeof(struct mrb_timer_worker));
+    if (!w) {
+      errno = ENOMEM;
+      goto done;
+    }
+    idx = workers_len;
+    workers[workers_len++] = w;
+  }
+
+  w = workers[idx];
+  /* from 1, so that no handle is 0; retired slots never come back here */
+  w->gen++;
+  w->thread = pthread_self();
+#ifdef MRB_TIMER_HAVE_DISPATCHER
+  w->tid = (pid_t)syscall(SYS_gettid);
+#endif
+  w->alive = 1;
+  handle = (w->gen << WORKER_INDEX_BITS) | idx;
+  pthread_setspecific(worker_key, (void *)(uintptr_t)handle);
+
+done:
+  pthread_mutex_unlock(&workers_lock);
+  return handle;
+}
+
+int mrb_timer_worker_lookup(uint32_t handle, pthread_t *thread, pid_t *tid)
+{
+  struct mrb_timer_worker *w;
+  int ret = -1;
+
+  pthread_mutex_lock(&workers_lock);
+  w = worker_find(handle);
+  if (w) {
+    *thread = w->thread;
+    *tid = w->tid;
+    ret = 0;
+  }
+  pthread_mutex_unlock(&workers_lock);
+  return ret;
+}
+
+int mrb_timer_worker_attach(uint32_t handle, struct mrb_timer_worker_link *link, timer_t timer)
+{
+  struct mrb_timer_worker *w;
+  int ret = -1;
+
+  pthread_mutex_lock(&workers_lock);
+  w = worker_find(handle);
+  if (w) {
+    link->timer = timer;
+    link->handle = handle;
+    link->next = w->links;
+    if (link->next) {
+      link->next->pprev = &link->next;
+    }
+    link->pprev = &w->links;
+    w->links = link;
+    w->count++;
+    ret = 0;
+  }
+  pthread_mutex_unlock(&workers_lock);
+  return ret;
+}
+
+void mrb_timer_worker_detach(struct mrb_timer_worker_link *link)
+{
+  struct mrb_timer_worker *w;
+
+  pthread_mutex_lock(&workers_lock);
+  if (link->pprev) {
+    *link->pprev = link->next;
+    if (link->next) {
+      link->next->pprev = link->pprev;
+    }
+    link->next = NULL;
+    link->pprev = NULL;
+    w = worker_find(link->handle);
+    if (w) {
+      w->count--;
+    }
+  }
+  pthread_mutex_unlock(&workers_lock);
+}
+
+/* under the lock: the exit destructor runs on the worker, it cannot be gone while we hold it */
+void mrb_timer_worker_send_signal(uint32_t handle, int signo, uint32_t id)
+{
+  struct mrb_timer_worker *w;
+
+  pthread_mutex_lock(&workers_lock);
+  w = worker_find(handle);
+  if (w) {
+    mrb_timer_send_signal(signo, 1, w->thread, id);
+  }
+  pthread_mutex_unlock(&workers_lock);
+}
+
+/* nil => the calling thread, otherwise a handle from Timer.worker */
+static uint32_t worker_arg(mrb_state *mrb, mrb_value v)
+{
+  uint32_t handle;
+
+  if (mrb_nil_p(v)) {
+    handle = mrb_timer_worker_self();
+    if (!handle) {
+      mrb_sys_fail(mrb, "Timer.worker");
+    }
+    return handle;
+  }
+  if (!mrb_fixnum_p(v)) {
+    mrb_raise(mrb, E_TYPE_ERROR, "worker must be an Integer");
+  }
+  return (uint32_t)mrb_fixnum(v);
+}
+
+/* Timer.worker => Integer handle of the calling thread, valid until it exits */
+static mrb_value mrb_timer_worker(mrb_state *mrb, mrb_value self)
+{
+  return mrb_fixnum_value((mrb_int)worker_arg(mrb, mrb_nil_value()));
+}
+
+static mrb_value mrb_timer_worker_alive(mrb_state *mrb, mrb_value self)
+{
+  mrb_value v;
+  int alive;
+
+  if (mrb_get_args(mrb, "o", &v) == -1) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot get arguments");
+  }
+  pthread_mutex_lock(&workers_lock);
+  alive = mrb_fixnum_p(v) && worker_find((uint32_t)mrb_fixnum(v)) != NULL;
+  pthread_mutex_unlock(&workers_lock);
+  return mrb_bool_value(alive);
+}
+
+/* Timer.worker_timers(worker = nil) => timers linked to the worker, 0 once it has exited */
+static mrb_value mrb_timer_worker_timers(mrb_state *mrb, mrb_value self)
+{
+  mrb_value v = mrb_nil_value();
+  struct mrb_timer_worker *w;
+  size_t n = 0;
+  uint32_t handle;
+
+  if (mrb_get_args(mrb, "|o", &v) == -1) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot get arguments");
+  }
+  handle = worker_arg(mrb, v);
+  pthread_mutex_lock(&workers_lock);
+  w = worker_find(handle);
+  if (w) {
+    n = w->count;
+  }
+  pthread_mutex_unlock(&workers_lock);
+  return mrb_fixnum_value((mrb_int)n);
+}
+
+/* Timer.cancel_worker(worker = nil) => timers disarmed, they stay linked and can be started again */
+static mrb_value mrb_timer_cancel_worker(mrb_state *mrb, mrb_value self)
+{
+  mrb_value v = mrb_nil_value();
+  struct mrb_timer_worker *w;
+  size_t n = 0;
+  uint32_t handle;
+
+  if (mrb_get_args(mrb, "|o", &v) == -1) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Cannot get arguments");
+  }
+  handle = worker_arg(mrb, v);
+  pthread_mutex_lock(&workers_lock);
+  w = worker_find(handle);
+  if (w) {
+    n = worker_cancel(w);
+  }
+  pthread_mutex_unlock(&workers_lock);
+  return mrb_fixnum_value((mrb_int)n);
+}
+
+void mrb_timer_define_worker(mrb_state *mrb, struct RClass *timer)
+{
+  mrb_define_module_function(mrb, timer, "worker", mrb_timer_worker, MRB_ARGS_NONE());
+  mrb_define_module_function(mrb, timer, "worker_alive?", mrb_timer_worker_alive, MRB_ARGS_REQ(1));
+  mrb_define_module_function(mrb, timer, "worker_timers", mrb_timer_worker_timers, MRB_ARGS_OPT(1));
+  mrb_define_module_function(mrb, timer, "cancel_worker", mrb_timer_cancel_worker, MRB_ARGS_OPT(1));
+}
+
+#endif
@@ -0,0 +1,94 @@
+assert("Timer::DeadlineSet#add and #expire") do
+  set = Timer::DeadlineSet.new(signal: nil)
+  assert_equal Timer::CLOCK_MONOTONIC, set.clock_id
+  assert_nil set.signo
+  assert_nil set.next_deadline_ns
+  assert_equal [], set.expire
+
+  late = set.add 60_000
+  handles = [30, 10, 20].map {|msec| set.add msec }
+  assert_equal 4, set.size
+  assert_true set.include?(late)
+  assert_equal set.deadline_ns(handles[1]), set.next_deadline_ns
+
+  usleep 50_000
+  assert_equal [handles[1], handles[2], handles[0]], set.expire
+  assert_equal 1, set.size
+  assert_false set.include?(handles[0])
+  assert_nil set.deadline_ns(handles[0])
+
+  assert_true set.delete(late)
+  assert_false set.delete(late)
+  assert_false set.delete(-1)
+  assert_equal 0, set.size
+end
+
+assert("Timer::DeadlineSet#expire with max") do
+  set = Timer::DeadlineSet.new(signal: nil)
+  now = set.now_ns
+  10.times {|i| set.add_at now - 1000 + i }
+  assert_equal 3, set.expire(3).size
+  assert_equal 7, set.expire.size
+  assert_raise(ArgumentError) { set.add_at 0 }
+end
+
+assert("Timer::DeadlineSet keeps entries in tens of bytes") do
+  set = Timer::DeadlineSet.new(signal: nil)
+  n = 100_000
+  n.times {|i| set.add 60_000 + i % 1000 }
+  assert_equal n, set.size
+  assert_true set.bytes / n <= 32
+  # handles are reused once given back
+  h = set.add 1
+  set.delete h
+  assert_equal h, set.add(1)
+end
+
+assert("Timer::DeadlineSet signals with its id for the earliest deadline") do
+  set = Timer::DeadlineSet.new(signal: :RT14)
+  assert_equal [], Timer.wait_any(:RT14, 0)
+  a = set.add 20
+  b = set.add 10
+  set.add 10_000
+
+  events = Timer.wait_any(:RT14, 1000)
+  assert_equal [set.id], events.map {|ev| ev[0] }
+  usleep 20_000
+  assert_equal [b, a], set.expire
+  assert_equal 1, set.size
+end
+
+assert("Timer::DeadlineSet#delete tombstones without re-arming") do
+  set = Timer::DeadlineSet.new(signal: nil)
+  handles = (1..100).map {|i| set.add 10_000 + i }
+  handles[0, 40].each {|h| assert_true set.delete(h) }
+  assert_equal 60, set.size
+  assert_equal 40, set.tombstones
+  assert_false set.include?(handles[0])
+  # the front tombstones are dropped when the earliest live deadline is asked for
+  assert_equal set.deadline_ns(handles[40]), set.next_deadline_ns
+  assert_equal 0, set.tombstones
+
+  handles[40, 60].each {|h| set.delete h }
+  assert_equal 0, set.size
+  assert_nil set.next_deadline_ns
+end
+
+assert("Timer::DeadlineSet compacts tombstones outnumbering the live entries") do
+  set = Timer::DeadlineSet.new(signal: nil)
+  base = set.now_ns
+  # 128 deadlines in the past, added out of order
+  deadlines = (0...128).map {|i| base - ((i * 37) % 128 + 1) * 1000 }
+  handles = deadlines.map {|d| set.add_at d }
+
+  # the 65th delete makes the tombstones more than half of the heap
+  gone = (0...128).select {|i| i.odd? } + [0]
+  gone.each {|i| assert_true set.delete(handles[i]) }
+  assert_equal 0, set.tombstones
+  assert_equal 63, set.size
+
+  live = (0...128).reject {|i| gone.include?(i) }
+  assert_equal live.map {|i| deadlines[i] }.min, set.next_deadline_ns
+  assert_equal live.sort_by {|i| deadlines[i] }.map {|i| handles[i] }, set.expire
+  assert_equal 0, set.size
+end
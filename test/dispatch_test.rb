@@ -0,0 +1,56 @@
+assert("Timer.dispatch fans one signal out to many Timer::POSIX") do
+  me = Timer.thread_id
+  timers = (1..20).map { Timer::POSIX.new(signal: :RT9, thread_id: me, dispatcher: false) }
+  fired = []
+  timers.each {|t| Timer.register(t) {|timer, info| fired << timer.id } }
+  # blocks the signal in this thread before the first expiry
+  assert_nil Timer.sigwaitinfo(:RT9, 0)
+
+  timers.each_with_index {|t, i| t.run 10 + i }
+  50.times do
+    break if fired.size == timers.size
+    Timer.dispatch_signals(:RT9, 100)
+  end
+  assert_equal timers.map {|t| t.id }.sort, fired.sort
+
+  timers.each {|t| assert_true Timer.unregister(t) }
+  assert_false Timer.unregister(timers[0])
+  assert_false Timer.dispatch(timers[0].id)
+end
+
+assert("Timer.dispatch with Timer::Wheel") do
+  me = Timer.thread_id
+  wt = Timer::Wheel.new(signal: :RT10, thread_id: me)
+  got = nil
+  Timer.register(wt) {|timer, info| got = [timer, info[:signo]] }
+  assert_nil Timer.sigwaitinfo(:RT10, 0)
+
+  wt.run 10
+  info = Timer.sigwaitinfo(:RT10, 1000)
+  assert_equal wt.id, info[:value]
+  assert_true Timer.dispatch(info)
+  assert_equal [wt, RTSignal.get(10)], got
+  Timer.unregister(wt)
+end
+
+assert("Timer.register without a block") do
+  assert_raise(ArgumentError) { Timer.register(Timer::POSIX.new(signal: nil)) }
+end
+
+assert("Timer.wait_any reaps queued signals in one call") do
+  me = Timer.thread_id
+  timers = (1..10).map { Timer::POSIX.new(signal: :RT11, thread_id: me, dispatcher: false) }
+  assert_equal [], Timer.wait_any(:RT11, 0)
+
+  timers.each {|t| t.run 10 }
+  usleep 100_000
+  events = Timer.wait_any([:RT11, :RT12], 1000)
+  assert_equal timers.map {|t| t.id }.sort, events.map {|ev| ev[0] }.sort
+  assert_true events.all? {|id, count, signo| count == 1 && signo == RTSignal.get(11) }
+
+  # at most max per call
+  timers.each {|t| t.run 10 }
+  usleep 100_000
+  assert_equal 4, Timer.wait_any(:RT11, 1000, 4).size
+  assert_equal 6, Timer.wait_any(:RT11, 0).size
+end
@@ -0,0 +1,32 @@
+assert("Timer.drain_events with queue: true Timer::POSIX") do
+  Timer.drain_events
+  pt = Timer::POSIX.new(queue: true, clock_id: Timer::CLOCK_MONOTONIC)
+  assert_nil pt.signo
+
+  pt.run 10, 10
+  usleep 100_000
+  pt.stop
+  usleep 10_000
+
+  events = Timer.drain_events
+  assert_true events.size >= 1
+  assert_true events.all? {|id, count, ts| id == pt.id && count >= 1 && ts > 0 }
+  # overruns are folded in the expiration counts
+  assert_true events.inject(0) {|sum, ev| sum + ev[1] } >= 5
+  assert_equal [], Timer.drain_events
+end
+
+assert("Timer.drain_events with queue: true Timer::Wheel") do
+  Timer.drain_events
+  wts = (1..5).map { Timer::Wheel.new(queue: true) }
+  ids = wts.map {|wt| wt.id }
+  wts.each {|wt| wt.run 20 }
+  while wts.any? {|wt| wt.running? } do
+    usleep 1000
+  end
+
+  events = Timer.drain_events(3)
+  assert_equal 3, events.size
+  events += Timer.drain_events
+  assert_equal ids.sort, events.map {|ev| ev[0] }.sort
+end
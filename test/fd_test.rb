@@ -0,0 +1,54 @@
+if Timer.const_defined?(:FD)
+  assert("Timer::FD.new") do
+    t = Timer::FD.new
+    assert_equal Timer::FD, t.class
+    assert_equal Timer::CLOCK_MONOTONIC, t.clock_id
+    assert_true t.fd >= 0
+    t.close
+    assert_true t.closed?
+  end
+
+  assert("Timer::FD#read_expirations") do
+    t = Timer::FD.new
+    assert_equal 0, t.read_expirations
+
+    t.run 50
+    assert_true t.running?
+    assert_equal 0, t.read_expirations
+
+    while t.running? do
+      usleep 1000
+    end
+    assert_equal 1, t.read_expirations
+    assert_equal 0, t.read_expirations
+    t.close
+  end
+
+  assert("Timer::FD interval expirations are coalesced") do
+    t = Timer::FD.new(clock_id: Timer::CLOCK_MONOTONIC)
+    t.run 10, 10
+    usleep 100_000
+    # settime resets the counter, so read before stopping
+    assert_true t.read_expirations >= 5
+    t.stop
+    t.close
+  end
+
+  assert("Timer::FD#start_every") do
+    t = Timer::FD.new(clock_id: Timer::CLOCK_REALTIME)
+    assert_nil t.every
+    t.start_every 20
+    assert_equal 20, t.every
+    usleep 100_000
+    assert_true t.read_expirations >= 3
+    t.stop
+    assert_nil t.every
+    t.close
+  end
+
+  assert("Timer::FD#close") do
+    t = Timer::FD.new
+    t.close
+    assert_raise(RuntimeError) { t.run 10 }
+  end
+end
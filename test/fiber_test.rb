@@ -0,0 +1,88 @@
+def fiber_now_msec
+  Timer.clock_gettime_ns(Timer::CLOCK_MONOTONIC) / 1_000_000
+end
+
+assert("Timer::FiberScheduler runs sleeping fibers on one thread") do
+  s = Timer::FiberScheduler.new
+  order = []
+  [30, 10, 20].each do |msec|
+    s.spawn do
+      Timer.sleep_fiber msec
+      order << msec
+    end
+  end
+
+  start = fiber_now_msec
+  s.run
+  elapsed = fiber_now_msec - start
+  assert_equal [10, 20, 30], order
+  # the sleeps overlap
+  assert_true elapsed >= 30
+  assert_true elapsed < 60
+  assert_nil Timer::FiberScheduler.current
+end
+
+assert("Timer::FiberScheduler with many waits") do
+  s = Timer::FiberScheduler.new
+  done = 0
+  1000.times {|i| s.spawn { s.sleep(i % 20); done += 1 } }
+  s.run
+  assert_equal 1000, done
+  assert_equal 0, s.parked
+end
+
+assert("Timer::FiberScheduler#wait and #wake") do
+  s = Timer::FiberScheduler.new
+  results = []
+  waiter = s.spawn { results << s.wait(1000) }
+  s.spawn { s.sleep 10; s.wake(waiter) }
+  s.spawn { results << s.wait(10) }
+
+  start = fiber_now_msec
+  s.run
+  assert_equal [false, true], results
+  assert_true fiber_now_msec - start < 500
+  assert_false s.wake(waiter)
+end
+
+assert("Timer::FiberScheduler#timeout") do
+  s = Timer::FiberScheduler.new
+  result = nil
+  s.spawn do
+    begin
+      s.timeout(20) { s.sleep 1000 }
+    rescue Timer::TimeoutError
+      result = :timeout
+    end
+  end
+  ok = nil
+  s.spawn { ok = s.timeout(100) {|msec| s.sleep 5; msec } }
+
+  start = fiber_now_msec
+  s.run
+  assert_equal :timeout, result
+  assert_equal 100, ok
+  assert_true fiber_now_msec - start < 500
+end
+
+assert("Timer::FiberScheduler#run raises on fibers that wait forever") do
+  s = Timer::FiberScheduler.new
+  woken = nil
+  waiter = s.spawn { woken = s.wait(nil) }
+  s.spawn { s.sleep 5 }
+  assert_raise(Timer::FiberScheduler::DeadlockError) { s.run }
+  assert_equal 1, s.parked
+  assert_nil Timer::FiberScheduler.current
+
+  # still parked, a wake lets it finish
+  assert_true s.wake(waiter)
+  s.run
+  assert_true woken
+  assert_equal 0, s.parked
+end
+
+assert("Timer.sleep_fiber outside of a scheduler") do
+  start = fiber_now_msec
+  Timer.sleep_fiber 20
+  assert_true fiber_now_msec - start >= 20
+end
@@ -0,0 +1,84 @@
+assert("Timer.metrics keys") do
+  m = Timer.metrics
+  %i(live_posix live_wheel live_scheduler live_thread live_deadline_sets live_deadlines
+     live_monotonic live_realtime live_cputime live_other_clock
+     live_signal live_thread_targeted live_queued live_no_signal
+     arms cancels fires overruns event_queue_depth events_dropped).each do |k|
+    assert_kind_of Integer, m[k]
+  end
+  assert_kind_of Integer, m[:dispatcher_cpu_ns] if Timer::POSIX.respond_to?(:dispatcher?)
+end
+
+assert("Timer.metrics counts live Timer::POSIX by clock and notification") do
+  before = Timer.metrics
+  pt = Timer::POSIX.new(signal: nil, clock_id: Timer::CLOCK_MONOTONIC)
+  m = Timer.metrics
+  assert_equal before[:live_posix] + 1, m[:live_posix]
+  assert_equal before[:live_monotonic] + 1, m[:live_monotonic]
+  assert_equal before[:live_no_signal] + 1, m[:live_no_signal]
+
+  pt.close
+  m = Timer.metrics
+  assert_equal before[:live_posix], m[:live_posix]
+  assert_equal before[:live_monotonic], m[:live_monotonic]
+end
+
+assert("Timer.metrics counts arms, cancels and fires") do
+  pt = Timer::POSIX.new(signal: nil, clock_id: Timer::CLOCK_MONOTONIC)
+  before = Timer.metrics
+  pt.run 1
+  usleep 5_000
+  pt.mark_fired
+  pt.run 60_000
+  pt.stop
+  m = Timer.metrics
+  assert_true m[:arms] >= before[:arms] + 2
+  assert_true m[:cancels] >= before[:cancels] + 1
+  assert_true m[:fires] >= before[:fires] + 1
+  pt.close
+end
+
+assert("Timer.metrics does not count stopping a disarmed timer as a cancel") do
+  pt = Timer::POSIX.new(signal: nil, clock_id: Timer::CLOCK_MONOTONIC)
+  before = Timer.metrics
+  pt.stop
+  pt.run 1
+  usleep 5_000
+  pt.stop
+  pt.close
+  assert_equal before[:cancels], Timer.metrics[:cancels]
+end
+
+assert("Timer.metrics refills the given Hash") do
+  h = Timer.metrics
+  assert_same h, Timer.metrics(h)
+  assert_equal Timer.metrics.size, h.size
+end
+
+assert("Timer.metrics counts DeadlineSet deadlines") do
+  set = Timer::DeadlineSet.new(signal: nil)
+  before = Timer.metrics
+  a = set.add 60_000
+  set.add 0
+  m = Timer.metrics
+  assert_equal before[:live_deadline_sets], m[:live_deadline_sets]
+  assert_equal before[:live_deadlines] + 2, m[:live_deadlines]
+
+  set.delete a
+  set.expire
+  assert_equal before[:live_deadlines], Timer.metrics[:live_deadlines]
+end
+
+assert("Timer.metrics moves a pooled timer between notification buckets") do
+  pool = Timer::Pool.new(1, clock_id: Timer::CLOCK_MONOTONIC)
+  before = Timer.metrics
+  pt = pool.checkout(signal: :USR1)
+  m = Timer.metrics
+  assert_equal before[:live_signal] + 1, m[:live_signal]
+  assert_equal before[:live_no_signal] - 1, m[:live_no_signal]
+  pool.checkin pt
+  m = Timer.metrics
+  assert_equal before[:live_signal], m[:live_signal]
+  assert_equal before[:live_no_signal], m[:live_no_signal]
+  pool.close
+end
@@ -42,3 +42,42 @@ assert("Timer::MRubyThread#run_with_signal") do
   sleep 1
   assert_true (finish - start) > timer_msec
 end
+
+assert("Timer::MRubyThread#blocking_handler") do
+  timer_msec = 200
+  start = Time.now.to_i * 1000 + Time.now.usec / 1000
+
+  th = Timer::MRubyThread.new
+  assert_false th.running?
+  th.run timer_msec
+  assert_true th.running?
+
+  called = false
+  th.blocking_handler do
+    called = true
+  end
+  finish = Time.now.to_i * 1000 + Time.now.usec / 1000
+
+  assert_true called
+  assert_false th.running?
+  assert_true (finish - start) >= timer_msec
+end
+
+assert("TimerThread with precision: :spin") do
+  th = TimerThread.new(precision: :spin, spin_usec: 200)
+  assert_equal :spin, th.precision
+  assert_equal 200, th.spin_usec
+  assert_equal :sleep, TimerThread.new.precision
+  assert_nil TimerThread.new(precision: :sleep).spin_usec
+
+  20.times do
+    start = Timer.clock_gettime_ns(Timer::CLOCK_MONOTONIC)
+    th.run 2
+    th.wait
+    # never early, the spin only replaces the tail of the sleep
+    assert_true Timer.clock_gettime_ns(Timer::CLOCK_MONOTONIC) - start >= 2_000_000
+  end
+
+  assert_raise(ArgumentError) { TimerThread.new(precision: :busy) }
+  assert_raise(ArgumentError) { TimerThread.new(precision: :spin, spin_usec: 0) }
+end
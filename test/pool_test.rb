@@ -0,0 +1,84 @@
+assert("Timer::POSIX#close") do
+  pt = Timer::POSIX.new(signal: nil)
+  pt.run 1000
+  assert_false pt.closed?
+  pt.close
+  assert_true pt.closed?
+  assert_raise(RuntimeError) { pt.running? }
+  assert_raise(RuntimeError) { pt.close }
+end
+
+assert("Timer::Pool#checkout, #checkin") do
+  pool = Timer::Pool.new(4, clock_id: Timer::CLOCK_MONOTONIC)
+  assert_equal 4, pool.available
+
+  pt = pool.checkout(signal: nil)
+  assert_equal Timer::POSIX, pt.class
+  assert_nil pt.signo
+  assert_equal Timer::CLOCK_MONOTONIC, pt.clock_id
+  assert_equal 3, pool.available
+
+  pt.run 50
+  while pt.running? do
+    usleep 1000
+  end
+  assert_equal 1, pt.read_expirations
+
+  pool.checkin pt
+  assert_true pt.closed?
+  assert_equal 4, pool.available
+
+  # grows when empty
+  pts = (1..6).map { pool.checkout(signal: :USR1) }
+  assert_equal 0, pool.available
+  assert_equal 10, pts.first.signo
+  pts.each {|t| t.close }
+  assert_equal 6, pool.available
+
+  other = Timer::Pool.new(1)
+  assert_raise(ArgumentError) { other.checkin pool.checkout }
+end
+
+assert("Timer::Pool re-points signal in place") do
+  count = 0
+  SignalThread.trap(:RT8) { count += 1 }
+
+  pool = Timer::Pool.new(1)
+  pt = pool.checkout(signal: :RT8)
+  pt.run 10
+  while count < 1 do
+    usleep 1000
+  end
+  pool.checkin pt
+
+  pt = pool.checkout(signal: nil)
+  pt.run 10
+  usleep 50_000
+  pool.checkin pt
+  assert_equal 1, count
+end
+
+assert("Timer::Pool#close") do
+  pool = Timer::Pool.new(2)
+  pt = pool.checkout(signal: nil)
+  pool.close
+  assert_true pool.closed?
+  assert_equal 0, pool.available
+  assert_raise(RuntimeError) { pool.checkout }
+
+  # still usable until checked in
+  pt.run 1000
+  assert_true pt.running?
+  pool.checkin pt
+  assert_equal 0, pool.available
+end
+
+assert("Timer::Pool raises when not initialized") do
+  pool = Timer::Pool.allocate
+  assert_raise(RuntimeError) { pool.checkout }
+  assert_raise(RuntimeError) { pool.checkin Timer::POSIX.new(signal: nil) }
+  assert_raise(RuntimeError) { pool.available }
+  assert_raise(RuntimeError) { pool.closed? }
+
+  assert_raise(ArgumentError) { Timer::Pool.new(-1) }
+end
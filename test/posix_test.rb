@@ -136,3 +136,166 @@ assert("Timer::POSIX with RTSignal, interval timer and block") do
     assert_equal "Unsupported platform", e.message
   end
 end
+
+assert("Timer::POSIX#read_expirations") do
+  pt = Timer::POSIX.new(signal: nil, clock_id: Timer::CLOCK_MONOTONIC)
+  assert_equal 0, pt.read_expirations
+
+  pt.run 20, 20
+  usleep 110_000
+  # first expiry and at least 3 intervals, even if no one was notified
+  assert_true pt.read_expirations >= 4
+  usleep 50_000
+  count = pt.read_expirations
+  assert_true count >= 1 && count <= 3
+  pt.stop
+
+  assert_equal 0, pt.read_expirations
+  assert_equal 0, pt.overrun
+end
+
+assert("Timer::POSIX#start_ns") do
+  pt = Timer::POSIX.new(signal: nil, clock_id: Timer::CLOCK_MONOTONIC)
+  start = Timer.clock_gettime_ns(Timer::CLOCK_MONOTONIC)
+  pt.start_ns 500_000
+
+  while pt.running? do
+    usleep 100
+  end
+  assert_true Timer.clock_gettime_ns(Timer::CLOCK_MONOTONIC) - start >= 500_000
+
+  pt.start_sec 0.0005, 0.0005
+  assert_true pt.interval?
+  pt.stop
+  assert_raise(ArgumentError) { pt.start_ns(-1) }
+end
+
+assert("Timer::POSIX#start_at") do
+  pt = Timer::POSIX.new(signal: nil, clock_id: Timer::CLOCK_MONOTONIC)
+  deadline = pt.now_ns + 50_000_000
+  pt.start_at deadline
+
+  while pt.running? do
+    usleep 1000
+  end
+  assert_true pt.now_ns >= deadline
+  assert_equal 1, pt.read_expirations
+
+  # a deadline already passed expires at once
+  pt.start_at pt.now_ns - 1_000_000
+  usleep 10_000
+  assert_false pt.running?
+  assert_raise(ArgumentError) { pt.start_at 0 }
+end
+
+assert("Timer::POSIX.create_many and Timer.start_all") do
+  pts = Timer::POSIX.create_many(10, signal: nil, clock_id: Timer::CLOCK_MONOTONIC)
+  assert_equal 10, pts.size
+  pts.each do |pt|
+    assert_equal Timer::POSIX, pt.class
+    assert_nil pt.signo
+    assert_equal Timer::CLOCK_MONOTONIC, pt.clock_id
+  end
+
+  Timer.start_all pts, 3000, 1000
+  assert_true pts.all? {|pt| pt.running? && pt.interval? }
+  pts.each {|pt| pt.stop }
+
+  Timer.start_all pts, (1..10).map {|i| [3000, i % 2 == 0 ? 1000 : 0] }
+  assert_equal 5, pts.count {|pt| pt.interval? }
+  pts.each {|pt| pt.stop }
+
+  assert_raise(ArgumentError) { Timer.start_all pts, [[100, 0]] }
+  assert_equal [], Timer::POSIX.create_many(0)
+end
+
+assert("Timer::POSIX#remaining_ns, #interval_ns, #stopped?") do
+  pt = Timer::POSIX.new(signal: nil)
+  assert_true pt.stopped?
+  assert_equal 0, pt.remaining_ns
+  assert_equal 0, pt.interval_ns
+
+  pt.run 3000, 1500
+  assert_false pt.stopped?
+  assert_true pt.remaining_ns > 2_000_000_000 && pt.remaining_ns <= 3_000_000_000
+  assert_equal 1_500_000_000, pt.interval_ns
+  assert_true pt.seconds_left > 2.0
+  pt.stop
+  assert_true pt.stopped?
+end
+
+assert("Timer::POSIX slack: coalesces deadlines") do
+  slack_ns = 100_000_000
+  pt1 = Timer::POSIX.new(signal: nil, clock_id: Timer::CLOCK_MONOTONIC, slack: 100)
+  pt2 = Timer::POSIX.new(signal: nil, clock_id: Timer::CLOCK_MONOTONIC, slack: 100)
+  assert_equal 100, pt1.slack
+
+  grid = (pt1.now_ns / slack_ns + 5) * slack_ns
+  pt1.start_at grid + 1
+  pt2.start_at grid + 50_000_000
+  # both rounded up to grid + slack
+  assert_true (pt1.remaining_ns - pt2.remaining_ns).abs < 1_000_000
+  assert_true pt1.remaining_ns > (grid - pt1.now_ns)
+
+  pt1.run 1000, 150
+  assert_equal 200_000_000, pt1.interval_ns
+  pt1.stop
+  pt2.stop
+end
+
+assert("Timer::POSIX signal: names resolve the same from Symbol and String") do
+  assert_equal Timer::POSIX.new(signal: "USR1").signo, Timer::POSIX.new(signal: :USR1).signo
+  assert_equal Timer::POSIX.new(signal: "SIGUSR1").signo, Timer::POSIX.new(signal: :SIGUSR1).signo
+  assert_equal RTSignal.get(0), Timer::POSIX.new(signal: :RT0).signo
+  assert_equal RTSignal.get(4), Timer::POSIX.new(signal: :SIGRT4).signo
+  assert_raise(ArgumentError) { Timer::POSIX.new(signal: :NOSUCHSIG) }
+end
+
+assert("Timer::POSIX cpu_budget: counts the CPU time of a thread") do
+  pt = Timer::POSIX.new(signal: nil, cpu_budget: true)
+  assert_not_equal Timer::CLOCK_REALTIME, pt.clock_id
+
+  pt.run 20
+  # sleeping burns no CPU
+  usleep 50_000
+  assert_true pt.running?
+
+  spent = pt.now_ns
+  i = 0
+  while pt.running? && i < 100_000_000
+    i += 1
+  end
+  assert_false pt.running?
+  assert_true pt.now_ns - spent >= 10_000_000
+
+  sth = SignalThread.trap(:USR1) { }
+  other = Timer::POSIX.new(signal: nil, cpu_budget: sth.thread_id)
+  assert_not_equal pt.clock_id, other.clock_id
+  assert_raise(ArgumentError) { Timer::POSIX.new(signal: nil, cpu_budget: "me") }
+end
+
+assert("Timer::POSIX#start_every") do
+  pt = Timer::POSIX.new(signal: nil, clock_id: Timer::CLOCK_REALTIME)
+  assert_nil pt.every
+  pt.start_every 100, 30
+  left = pt.remaining_ns
+  due = pt.now_ns + left
+  assert_true left > 0 && left <= 100_000_000
+  assert_equal 100_000_000, pt.interval_ns
+  assert_equal 100, pt.every
+  # on the grid, give or take the time between the two reads
+  assert_true((due - 30_000_000) % 100_000_000 < 5_000_000)
+
+  # nothing to do while the clock was not set back
+  assert_false pt.realign
+
+  usleep 250_000
+  assert_true pt.read_expirations >= 2
+  pt.run 1000
+  assert_nil pt.every
+  assert_false pt.realign
+  assert_raise(ArgumentError) { pt.start_every 0 }
+  # slack rounding would move the schedule off the grid
+  slack = Timer::POSIX.new(signal: nil, clock_id: Timer::CLOCK_REALTIME, slack: 100)
+  assert_raise(ArgumentError) { slack.start_every 150, 30 }
+end
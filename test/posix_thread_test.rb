@@ -27,3 +27,38 @@ assert("Timer::POSIX with RTSignal, interval timer and block") do
     assert_equal "Unsupported platform", e.message
   end
 end
+
+assert("Timer::POSIX with thread_id through the dispatcher thread") do
+  timer_msec = 10
+  sem = false
+  v1 = 0
+  v2 = 0
+
+  t1 = SignalThread.trap(:RT7) { v1 += 1; sem = true }
+  t2 = SignalThread.trap(:RT7) { v2 += 1; sem = true }
+
+  pt = Timer::POSIX.new(thread_id: t2.thread_id, signal: :RT7, dispatcher: true)
+  assert_true pt.dispatched?
+  assert_equal RTSignal.get(7), pt.signo
+  pt.run(timer_msec, timer_msec)
+  until v2 >= 3
+    usleep 1000 rescue nil
+  end
+  pt.stop
+  assert_equal 0, v1
+
+  Timer::POSIX.dispatcher = true
+  begin
+    pt = Timer::POSIX.new(thread_id: t1.thread_id, signal: :RT7)
+    assert_true pt.dispatched?
+    sem = false
+    pt.run(timer_msec)
+    until sem
+      usleep 1000 rescue nil
+    end
+    assert_equal 1, v1
+    assert_false Timer::POSIX.new(thread_id: t1.thread_id, signal: :RT7, dispatcher: false).dispatched?
+  ensure
+    Timer::POSIX.dispatcher = false
+  end
+end
@@ -0,0 +1,54 @@
+def timer_profiler_busy(n)
+  i = 0
+  while i < n
+    i += 1
+  end
+  i
+end
+
+assert("Timer::Profiler samples the call stack") do
+  prof = Timer::Profiler.new(interval_usec: 1000, size: 1024)
+  assert_false prof.running?
+  prof.start
+  assert_true prof.running?
+  assert_raise(RuntimeError) { Timer::Profiler.new.start }
+  timer_profiler_busy(3_000_000)
+  prof.stop
+  assert_false prof.running?
+
+  assert_true prof.samples > 0
+  report = prof.report
+  assert_equal 0, prof.samples
+  assert_true report.values.inject(0) {|sum, n| sum + n } > 0
+  assert_true report.keys.any? {|stack| stack.include?("timer_profiler_busy") }
+end
+
+assert("Timer::Profiler.profile returns folded stacks") do
+  folded = Timer::Profiler.profile(interval_usec: 500) { timer_profiler_busy(2_000_000) }
+  assert_kind_of String, folded
+  assert_true folded.split("\n").all? {|line| line.split(" ").last.to_i > 0 }
+end
+
+assert("Timer::Profiler drops ticks when the ring is full") do
+  prof = Timer::Profiler.new(interval_usec: 200, size: 2)
+  prof.start
+  timer_profiler_busy(3_000_000)
+  prof.stop
+  assert_equal 2, prof.samples
+  assert_true prof.dropped > 0
+end
+
+def timer_profiler_deep(n)
+  n == 0 ? timer_profiler_busy(20_000) : timer_profiler_deep(n - 1)
+end
+
+assert("Timer::Profiler samples while the callinfo array grows") do
+  prof = Timer::Profiler.new(interval_usec: 100, size: 4096)
+  prof.start
+  20.times { timer_profiler_deep(500) }
+  prof.stop
+  report = prof.report
+  assert_true prof.skipped >= 0
+  assert_true report.keys.all? {|stack| stack.split(";").size <= Timer::Profiler::MAX_DEPTH }
+  assert_true report.keys.any? {|stack| stack.include?("timer_profiler_deep") }
+end
@@ -0,0 +1,105 @@
+assert("Timer::Scheduler#run") do
+  timer_msec = 100
+  start = Time.now.to_i * 1000 + Time.now.usec / 1000
+
+  th = Timer::Scheduler.new
+  th.run timer_msec
+  assert_true th.running?
+
+  while th.running? do
+    usleep 1000
+  end
+
+  finish = Time.now.to_i * 1000 + Time.now.usec / 1000
+  assert_true (finish - start) >= timer_msec
+end
+
+assert("Timer::Scheduler#run_with_signal") do
+  count = 0
+  sth = SignalThread.trap(:USR2) { count += 1 }
+
+  th = Timer::Scheduler.new
+  th.run_with_signal 50, :USR2, sth.thread_id
+  th.wait
+  until count > 0
+    usleep 1000
+  end
+  assert_equal 1, count
+end
+
+assert("Timer::Scheduler#blocking_handler") do
+  timer_msec = 50
+  start = Time.now.to_i * 1000 + Time.now.usec / 1000
+  finish = nil
+
+  th = Timer::Scheduler.new
+  th.run timer_msec
+  th.blocking_handler do
+    finish = Time.now.to_i * 1000 + Time.now.usec / 1000
+  end
+
+  assert_true (finish - start) >= timer_msec
+end
+
+assert("Timer::Scheduler shares one thread for many timers") do
+  timers = (1..200).map { Timer::Scheduler.new }
+  timers.each_with_index {|th, i| th.run 200 + (i % 10) }
+  assert_true Timer::Scheduler.pending >= 200
+
+  timers.each {|th| th.wait }
+  assert_true timers.none? {|th| th.running? }
+end
+
+assert("Timer::Scheduler#stop and rescheduling") do
+  th = Timer::Scheduler.new
+  th.run 10_000
+  th.run 10
+  th.wait
+  assert_false th.running?
+
+  th.run 10_000
+  th.stop
+  assert_false th.running?
+  th.wait
+end
+
+assert("Timer::Scheduler#stop leaves a tombstone that never fires") do
+  count = 0
+  sth = SignalThread.trap(:USR2) { count += 1 }
+  base = Timer::Scheduler.pending
+
+  cancelled = (1..500).map { Timer::Scheduler.new }
+  cancelled.each {|th| th.run_with_signal 20, :USR2, sth.thread_id }
+  cancelled.each {|th| th.stop }
+  assert_equal base, Timer::Scheduler.pending
+  assert_true cancelled.none? {|th| th.running? }
+
+  # a stopped entry is revived in place
+  th = cancelled[0]
+  th.run 10
+  assert_true th.running?
+  th.wait
+
+  usleep 50_000
+  assert_equal 0, count
+end
+
+assert("Timer::Scheduler keeps the survivors in order when compacting") do
+  # 50 survivors 5 msec apart, scrambled among 250 entries that get stopped
+  survivors = (0...50).map { Timer::Scheduler.new }
+  cancelled = (0...250).map { Timer::Scheduler.new }
+  all = survivors + cancelled
+  due = {}
+  survivors.each_with_index {|th, k| due[th] = 100 + 5 * ((k * 17) % 50) }
+  cancelled.each_with_index {|th, k| due[th] = 50 + (k * 7) % 400 }
+  all.sort_by {|th| (due[th] * 31) % 97 }.each {|th| th.run due[th] }
+  cancelled.each {|th| th.stop }
+
+  order = []
+  until order.size == survivors.size
+    survivors.each {|th| order << th if !th.running? && !order.include?(th) }
+    usleep 1000
+  end
+  assert_equal survivors.sort_by {|th| due[th] }, order
+  assert_true cancelled.none? {|th| th.running? }
+end
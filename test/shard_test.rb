@@ -0,0 +1,43 @@
+assert("Timer.shards and Timer.current_shard") do
+  assert_true Timer.shards >= 1
+  shard = Timer.current_shard
+  assert_true shard >= 0 && shard < Timer.shards
+end
+
+assert("Timer::POSIX with shard:") do
+  pt = Timer::POSIX.new(signal: nil, shard: 0)
+  assert_equal 0, pt.shard
+  assert_true pt.dispatched?
+  assert_nil Timer::POSIX.new(signal: nil).shard
+
+  assert_raise(ArgumentError) { Timer::POSIX.new(signal: nil, shard: Timer.shards) }
+  assert_raise(ArgumentError) { Timer::POSIX.new(signal: nil, shard: -1) }
+  assert_raise(TypeError) { Timer::POSIX.new(signal: nil, shard: "0") }
+end
+
+assert("Timer::POSIX with queue: true on a shard") do
+  Timer.drain_events
+  pt = Timer::POSIX.new(queue: true, shard: Timer.shards - 1, clock_id: Timer::CLOCK_MONOTONIC)
+  pt.run 10
+  usleep 50_000
+
+  events = Timer.drain_events
+  assert_equal [pt.id], events.map {|ev| ev[0] }
+end
+
+assert("Timer::Scheduler and Timer::Wheel with shard:") do
+  th = Timer::Scheduler.new(shard: 0)
+  assert_equal 0, th.shard
+  assert_nil Timer::Scheduler.new.shard
+  th.run 20
+  th.wait
+  assert_false th.running?
+
+  wt = Timer::Wheel.new(signal: nil, shard: 0)
+  assert_equal 0, wt.shard
+  wt.run 20
+  while wt.running? do
+    usleep 1000
+  end
+  assert_equal 1, wt.stats[:fired]
+end
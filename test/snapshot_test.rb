@@ -0,0 +1,59 @@
+assert("Timer.snapshot and Timer.restore") do
+  mono = Timer::CLOCK_MONOTONIC
+  a = Timer::POSIX.new(signal: nil, clock_id: mono)
+  b = Timer::POSIX.new(signal: :RT13, clock_id: Timer::CLOCK_REALTIME, slack: 5)
+  idle = Timer::POSIX.new(signal: nil, clock_id: mono)
+  cpu = Timer::POSIX.new(signal: nil, clock_id: Timer::CLOCK_PROCESS_CPUTIME_ID)
+  a.start 5000, 1000
+  b.start 6000
+  cpu.start 5000
+
+  dump = Timer.snapshot([a, b, idle, cpu])
+  header = 16
+  assert_equal header + 2 * 56, dump.size
+
+  restored = Timer.restore(dump)
+  assert_equal 2, restored.size
+  ra, rb = restored
+  assert_equal mono, ra.clock_id
+  assert_nil ra.signo
+  assert_equal 1_000_000_000, ra.interval_ns
+  assert_true (ra.remaining_ns - a.remaining_ns).abs < 100_000_000
+  assert_equal RTSignal.get(13), rb.signo
+  assert_equal 5, rb.slack
+  assert_false rb.interval?
+  assert_true rb.remaining_ns > 5_000_000_000
+
+  # options apply to every restored timer, signal: overrides the dump
+  assert_nil Timer.restore(dump, signal: nil)[1].signo
+  [a, b, cpu, ra, rb].each {|t| t.stop }
+end
+
+assert("Timer.restore with a deadline already past") do
+  pt = Timer::POSIX.new(signal: nil, clock_id: Timer::CLOCK_MONOTONIC)
+  pt.start 10
+  dump = Timer.snapshot([pt])
+  usleep 30_000
+  rt = Timer.restore(dump)[0]
+  usleep 10_000
+  assert_false rt.running?
+  assert_equal 1, rt.read_expirations
+end
+
+assert("Timer.restore rejects bad dumps") do
+  assert_raise(ArgumentError) { Timer.restore("MRTS") }
+  assert_raise(ArgumentError) { Timer.restore("x" * 16) }
+  dump = Timer.snapshot([Timer::POSIX.new(signal: nil).start(1000)])
+  assert_raise(ArgumentError) { Timer.restore(dump[0, dump.size - 1]) }
+end
+
+assert("Timer.restore keeps start_every schedules") do
+  pt = Timer::POSIX.new(signal: nil, clock_id: Timer::CLOCK_REALTIME)
+  pt.start_every 60_000, 30_000
+  rt = Timer.restore(Timer.snapshot([pt]))[0]
+  assert_equal 60_000, rt.every
+  assert_equal 60_000_000_000, rt.interval_ns
+  assert_true (rt.remaining_ns - pt.remaining_ns).abs < 100_000_000
+  assert_false rt.realign
+  [pt, rt].each {|t| t.stop }
+end
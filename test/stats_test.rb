@@ -0,0 +1,66 @@
+assert("Timer::POSIX#stats before any expiry") do
+  pt = Timer::POSIX.new(signal: nil, clock_id: Timer::CLOCK_MONOTONIC)
+  st = pt.stats
+  assert_equal 0, st[:fired]
+  assert_equal 0, st[:overruns]
+  assert_nil st[:p50_ns]
+  assert_nil st[:max_ns]
+end
+
+assert("Timer::POSIX#mark_fired records lateness") do
+  pt = Timer::POSIX.new(signal: nil, clock_id: Timer::CLOCK_MONOTONIC)
+  pt.run 10
+  usleep 30_000
+  pt.mark_fired
+
+  st = pt.stats
+  assert_equal 1, st[:fired]
+  # fired in the past at least 20 msec ago
+  assert_true st[:min_ns] >= 10_000_000
+  assert_true st[:min_ns] <= st[:p50_ns] && st[:p50_ns] <= st[:p99_ns] && st[:p99_ns] <= st[:max_ns]
+
+  pt.reset_stats
+  assert_equal 0, pt.stats[:fired]
+end
+
+assert("Timer::POSIX#stats of an interval timer counts overruns") do
+  pt = Timer::POSIX.new(signal: nil, clock_id: Timer::CLOCK_MONOTONIC)
+  pt.run 10, 10
+  usleep 15_000
+  pt.mark_fired
+  usleep 50_000
+  pt.mark_fired
+  pt.stop
+
+  st = pt.stats
+  assert_equal 2, st[:fired]
+  assert_true st[:overruns] >= 3
+  assert_true st[:max_ns] < 10_000_000
+end
+
+assert("Timer::POSIX#stats recorded by the dispatcher") do
+  pt = Timer::POSIX.new(queue: true, clock_id: Timer::CLOCK_MONOTONIC)
+  pt.run 10, 10
+  usleep 100_000
+  pt.stop
+  Timer.drain_events
+
+  st = pt.stats
+  assert_true st[:fired] >= 1
+  assert_true st[:fired] + st[:overruns] >= 5
+  assert_true st[:mean_ns] <= st[:max_ns]
+end
+
+assert("Timer::Wheel#stats") do
+  wt = Timer::Wheel.new(signal: nil)
+  wt.run 10
+  while wt.running? do
+    usleep 1000
+  end
+
+  st = wt.stats
+  assert_equal 1, st[:fired]
+  assert_true st[:max_ns] >= 0
+  wt.reset_stats
+  assert_equal 0, wt.stats[:fired]
+end
@@ -0,0 +1,98 @@
+assert("Timer.timeout returns the block value in time") do
+  assert_equal 42, Timer.timeout(1000) { 42 }
+  assert_nil Timer.timeout_remaining_ns
+end
+
+assert("Timer.timeout raises Timer::TimeoutError on expiry") do
+  assert_raise(Timer::TimeoutError) do
+    Timer.timeout(10) { usleep 30_000 }
+  end
+  assert_nil Timer.timeout_remaining_ns
+end
+
+assert("Timer.check_timeout inside a scope") do
+  hit = 0
+  assert_raise(Timer::TimeoutError) do
+    Timer.timeout(20) do
+      loop do
+        Timer.check_timeout
+        hit += 1
+        usleep 1000
+      end
+    end
+  end
+  assert_true hit > 0
+  assert_nil Timer.check_timeout
+end
+
+assert("Timer.timeout nests, the earliest deadline wins") do
+  Timer.timeout(5000) do
+    outer = Timer.timeout_remaining_ns
+    Timer.timeout(100) do
+      assert_true Timer.timeout_remaining_ns <= 100_000_000
+    end
+    assert_true Timer.timeout_remaining_ns > 100_000_000
+    assert_true Timer.timeout_remaining_ns <= outer
+
+    assert_raise(Timer::TimeoutError) do
+      Timer.timeout(5) { usleep 20_000 }
+    end
+  end
+end
+
+assert("Timer.timeout closes its scope when the block raises") do
+  assert_raise(ArgumentError) do
+    Timer.timeout(1000) { raise ArgumentError }
+  end
+  assert_nil Timer.timeout_remaining_ns
+end
+
+if Timer::TIMEOUT_INTERRUPTS
+  assert("Timer.timeout interrupts a block that never returns") do
+    t = Time.now
+    assert_raise(Timer::TimeoutError) do
+      Timer.timeout(20) { loop {} }
+    end
+    assert_true Time.now - t < 5
+    assert_nil Timer.timeout_remaining_ns
+  end
+
+  assert("Timer.timeout interrupts the inner block for an outer deadline") do
+    inner_done = false
+    assert_raise(Timer::TimeoutError) do
+      Timer.timeout(20) do
+        Timer.timeout(60_000) { loop {} }
+        inner_done = true
+      end
+    end
+    assert_false inner_done
+    assert_nil Timer.timeout_remaining_ns
+  end
+else
+  assert("Timer.timeout only checks the deadline when the block exits") do
+    i = 0
+    t = Time.now
+    assert_raise(Timer::TimeoutError) do
+      Timer.timeout(10) { i += 1 while Time.now - t < 0.1 }
+    end
+    # the block ran to its end, well past the deadline
+    assert_true Time.now - t >= 0.1
+  end
+end
+
+if Timer.const_defined?(:TIMEOUT_SIGNAL)
+  assert("Timer.timeout expiry interrupts a blocking sleep with EINTR") do
+    t = Time.now
+    assert_raise(Timer::TimeoutError) do
+      Timer.timeout(20) { sleep 2 }
+    end
+    assert_true Time.now - t < 1.5
+  end
+end
+
+if Timer.const_defined?(:DISPATCHER_SIGNAL)
+  assert("Timer::TIMEOUT_SIGNAL and Timer::DISPATCHER_SIGNAL are the two highest RT signals") do
+    assert_equal Timer::DISPATCHER_SIGNAL - 1, Timer::TIMEOUT_SIGNAL
+    assert_true Timer::TIMEOUT_SIGNAL > RTSignal.get(0)
+  end
+end
@@ -0,0 +1,69 @@
+assert("Timer::Wheel.new") do
+  t = Timer::Wheel.new
+  assert_equal Timer::Wheel, t.class
+  assert_equal 14, t.signo
+
+  t = Timer::Wheel.new(signal: nil)
+  assert_nil t.signo
+end
+
+assert("Timer::Wheel#run") do
+  timer_msec = 200
+
+  wt = Timer::Wheel.new(signal: nil)
+  start = Time.now.to_i * 1000 + Time.now.usec / 1000
+  wt.run timer_msec
+  assert_true wt.running?
+
+  while wt.running? do
+    usleep 1000
+  end
+  finish = Time.now.to_i * 1000 + Time.now.usec / 1000
+  assert_true (finish - start) >= timer_msec
+end
+
+assert("Timer::Wheel#stop") do
+  wt = Timer::Wheel.new(signal: nil)
+  wt.run 10_000
+  assert_true wt.running?
+  wt.stop
+  assert_false wt.running?
+end
+
+assert("Timer::Wheel many timers share one wheel thread") do
+  base = Timer::Wheel.pending
+  wts = (1..1000).map {|i| Timer::Wheel.new(signal: nil).run(50 + i % 100) }
+  assert_equal base + 1000, Timer::Wheel.pending
+
+  while wts.any? {|wt| wt.running? } do
+    usleep 1000
+  end
+  assert_equal base, Timer::Wheel.pending
+end
+
+assert("Timer::Wheel with RTSignal, interval timer and block") do
+  timer_msec = 100
+  count = 0
+
+  SignalThread.trap(:RT6) { count += 1 }
+  wt = Timer::Wheel.new(signal: :RT6)
+  wt.run timer_msec, timer_msec
+
+  while count < 4 do
+    usleep 1000
+  end
+  wt.stop
+
+  assert_true count >= 4
+end
+
+assert("Timer::Wheel slack: rounds expiries") do
+  wt = Timer::Wheel.new(signal: nil, slack: 50)
+  start = Time.now.to_i * 1000 + Time.now.usec / 1000
+  wt.run 10
+  while wt.running? do
+    usleep 1000
+  end
+  finish = Time.now.to_i * 1000 + Time.now.usec / 1000
+  assert_true (finish - start) >= 10
+end
@@ -0,0 +1,42 @@
+assert("Timer.worker") do
+  w = Timer.worker
+  assert_kind_of Integer, w
+  assert_equal w, Timer.worker
+  assert_true Timer.worker_alive?(w)
+  assert_false Timer.worker_alive?("w")
+end
+
+assert("Timer::POSIX with worker:") do
+  before = Timer.worker_timers
+  pt = Timer::POSIX.new(signal: nil, worker: true, clock_id: Timer::CLOCK_MONOTONIC)
+  assert_equal Timer.worker, pt.worker
+  assert_nil Timer::POSIX.new(signal: nil).worker
+  assert_equal before + 1, Timer.worker_timers
+
+  pt.run 60_000
+  assert_true pt.running?
+  assert_true Timer.cancel_worker >= 1
+  assert_false pt.running?
+
+  pt.close
+  assert_equal before, Timer.worker_timers
+  assert_raise(TypeError) { Timer::POSIX.new(signal: nil, worker: "me") }
+end
+
+assert("Timer::POSIX with worker: signals the worker") do
+  pt = Timer::POSIX.new(signal: :RT15, worker: Timer.worker, clock_id: Timer::CLOCK_MONOTONIC)
+  # blocks the signal in this thread before the expiry
+  assert_nil Timer.sigwaitinfo(:RT15, 0)
+  pt.run 10
+  info = Timer.sigwaitinfo(:RT15, 1000)
+  assert_equal pt.id, info[:value]
+  pt.close
+end
+
+assert("Timer.worker of an exited thread") do
+  w = Thread.new { Timer.worker }.join
+  assert_not_equal Timer.worker, w
+  assert_false Timer.worker_alive?(w)
+  assert_equal 0, Timer.worker_timers(w)
+  assert_raise(ArgumentError) { Timer::POSIX.new(signal: nil, worker: w) }
+end